@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simple_convolver.h"
+
+/* Times the convolver on made up impulses, six inputs to two outputs, as dh2
+ * runs them, at each block size, to compare FFT libraries, as named in
+ * CONVOLVER_FFT. Prints how long each second of 48 kHz audio takes. */
+
+#define INPUTS 6
+#define OUTPUTS 2
+#define RATE 48000
+#define CHUNK 1024
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+	static const int sizes[] = { 64, 256, 1024, 4096 };
+	int impulse_size = argc > 1 ? atoi(argv[1]) : 16384;
+	float *impulse[INPUTS];
+	float *inbuffer, *outbuffer;
+	unsigned int seed = 1;
+	unsigned int i, j;
+
+	if(impulse_size < 32) {
+		fprintf(stderr, "Usage:\tbench [impulse size]\n");
+		return 1;
+	}
+
+	inbuffer = (float *)malloc(sizeof(float) * CHUNK * INPUTS);
+	outbuffer = (float *)malloc(sizeof(float) * CHUNK * OUTPUTS);
+	if(!inbuffer || !outbuffer)
+		return 1;
+
+	for(i = 0; i < INPUTS; ++i) {
+		impulse[i] = (float *)malloc(sizeof(float) * impulse_size * OUTPUTS);
+		if(!impulse[i])
+			return 1;
+		for(j = 0; j < (unsigned int)impulse_size * OUTPUTS; ++j) {
+			seed = seed * 1103515245 + 12345;
+			impulse[i][j] = ((float)((seed >> 16) & 0x7fff) / 16384.0f - 1.0f) / (float)(j / OUTPUTS + 1);
+		}
+	}
+
+	for(i = 0; i < CHUNK * INPUTS; ++i) {
+		seed = seed * 1103515245 + 12345;
+		inbuffer[i] = (float)((seed >> 16) & 0x7fff) / 16384.0f - 1.0f;
+	}
+
+	printf("%d samples per impulse\n", impulse_size);
+
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		convolver_options options;
+		double start, elapsed;
+		int runs = 0;
+		void *conv;
+
+		memset(&options, 0, sizeof(options));
+		options.block_size = sizes[i];
+		options.latency = sizes[i];
+
+		conv = convolver_create_ex((const float *const *)impulse, impulse_size, INPUTS, OUTPUTS, 2, &options);
+		if(!conv) {
+			fprintf(stderr, "Unable to create convolver.\n");
+			return 1;
+		}
+
+		for(j = 0; j < 16; ++j)
+			convolver_run(conv, inbuffer, outbuffer, CHUNK);
+
+		start = now();
+		do {
+			for(j = 0; j < 16; ++j)
+				convolver_run(conv, inbuffer, outbuffer, CHUNK);
+			runs += 16;
+			elapsed = now() - start;
+		} while(elapsed < 0.5);
+
+		printf("block %5d: %8.3f ms per second\n", sizes[i], elapsed * 1000.0 * RATE / ((double)runs * CHUNK));
+
+		convolver_delete(conv);
+	}
+
+	convolver_cleanup();
+
+	for(i = 0; i < INPUTS; ++i)
+		free(impulse[i]);
+	free(inbuffer);
+	free(outbuffer);
+
+	return 0;
+}
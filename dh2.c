@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "simple_convolver.h"
 
@@ -19,6 +20,55 @@ unsigned int get_be32(const unsigned char *ptr) {
 	return ptr[3] + (ptr[2] << 8) + (ptr[1] << 16) + (ptr[0] << 24);
 }
 
+/* Offline renders don't care about latency, so time a few block sizes on the
+ * preset in use, and keep whichever gets through the most samples. */
+
+static int pick_block_size(const speaker_impulses *impulses) {
+	static const int sizes[] = { 256, 512, 1024, 2048, 4096, 8192 };
+	float inbuffer[1024 * 6];
+	float outbuffer[1024 * 2];
+	unsigned int seed = 1;
+	clock_t best_time = 0;
+	int best = 512;
+	unsigned int i, j;
+
+	for(i = 0; i < 1024 * 6; ++i) {
+		seed = seed * 1103515245 + 12345;
+		inbuffer[i] = (float)((seed >> 16) & 0x7fff) / 16384.0f - 1.0f;
+	}
+
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		convolver_options options;
+		clock_t start, elapsed;
+		void *conv;
+
+		memset(&options, 0, sizeof(options));
+		options.block_size = sizes[i];
+		options.latency = sizes[i];
+		options.impulse_sizes = impulses->sizes;
+
+		conv = convolver_create_ex(impulses->impulse, impulses->count, 6, 2, 2, &options);
+		if(!conv) continue;
+
+		for(j = 0; j < 8; ++j)
+			convolver_run(conv, inbuffer, outbuffer, 1024);
+
+		start = clock();
+		for(j = 0; j < 64; ++j)
+			convolver_run(conv, inbuffer, outbuffer, 1024);
+		elapsed = clock() - start;
+
+		convolver_delete(conv);
+
+		if(!best_time || elapsed < best_time) {
+			best_time = elapsed;
+			best = sizes[i];
+		}
+	}
+
+	return best;
+}
+
 int main(int argc, char **argv) {
 	FILE *f, *g;
 	unsigned char buffer[1024];
@@ -26,17 +76,42 @@ int main(int argc, char **argv) {
 	unsigned int id;
 	unsigned int sample_rate, sample_count, samples_out;
 	unsigned int sample, preset, samples_written;
+	unsigned int latency, skip;
 	unsigned int i;
+	int offline = 0;
+	int threads = 0;
+	const char *wisdom = NULL;
 
 	const speaker_preset *set;
 
-	void *conv;
+	void *conv, *spectra;
 
 	float inbuffer[1024 * 6];
 	float outbuffer[1024 * 2];
 
+	while(argc > 3) {
+		if(!strcmp(argv[1], "-o")) {
+			offline = 1;
+		} else if(!strcmp(argv[1], "-t") && argc > 4) {
+			threads = atoi(argv[2]);
+			++argv;
+			--argc;
+		} else if(!strcmp(argv[1], "-w") && argc > 4) {
+			wisdom = argv[2];
+			++argv;
+			--argc;
+		} else {
+			break;
+		}
+		++argv;
+		--argc;
+	}
+
 	if(argc != 3) {
-		fprintf(stderr, "Usage:\tdh2 <input.wav> <output.raw>\n");
+		fprintf(stderr, "Usage:\tdh2 [-o] [-t threads] [-w wisdom] <input.wav> <output.raw>\n");
+		fprintf(stderr, "\t-o\toffline, trade latency for speed\n");
+		fprintf(stderr, "\t-t\tthreads to split the work across\n");
+		fprintf(stderr, "\t-w\tFFTW wisdom file, measured and saved if missing\n");
 		return 1;
 	}
 
@@ -145,13 +220,56 @@ int main(int argc, char **argv) {
 		if(set[preset].frequency == sample_rate) break;
 	}
 
-	conv = convolver_create(set[preset].impulses->impulse, set[preset].impulses->count, 6, 2, 2);
+	/* With wisdom, plans are measured once, and only loaded after that. */
+
+	if(wisdom) {
+		convolver_load_wisdom(wisdom);
+		convolver_set_planning(CONVOLVER_PLAN_MEASURE);
+	}
+
+	/* Spectra built in ahead of time are used as they are, unless the
+	 * block size is being picked here. */
+
+	if(!offline && speaker_spectra_sets[1].frequency == sample_rate &&
+	   (spectra = convolver_impulses_wrap(speaker_spectra_sets[1].spectra, speaker_spectra_sets[1].count, 6, 2, 2)) != NULL) {
+		convolver_options options;
+		memset(&options, 0, sizeof(options));
+		options.threads = threads;
+		conv = convolver_create_shared(spectra, &options);
+		convolver_impulses_release(spectra);
+	} else {
+		/* Each speaker's impulse is only as long as it needs to be. */
+
+		convolver_options options;
+		memset(&options, 0, sizeof(options));
+		if(offline) {
+			options.block_size = pick_block_size(set[preset].impulses);
+			options.latency = options.block_size;
+			fprintf(stderr, "Using block size %d.\n", options.block_size);
+		}
+		options.threads = threads;
+		options.impulse_sizes = set[preset].impulses->sizes;
+		conv = convolver_create_ex(set[preset].impulses->impulse, set[preset].impulses->count, 6, 2, 2, &options);
+	}
+
+	if(!conv) {
+		fclose(g);
+		fclose(f);
+		fprintf(stderr, "Unable to create convolver.\n");
+		return 1;
+	}
+
+	if(wisdom)
+		convolver_save_wisdom(wisdom);
+
+	latency = convolver_get_latency(conv);
 
 	sample = 0;
 	samples_written = 0;
 
 	while(samples_written < sample_count) {
 		size_t samples_in = 0;
+		size_t samples_out;
 		while(samples_in < 1024 && sample < sample_count) {
 			size_t samples_to_read = sample_count - sample;
 			if(samples_to_read > 1024 - samples_in)
@@ -161,13 +279,33 @@ int main(int argc, char **argv) {
 			samples_in += samples_to_read;
 		}
 
+		/* Past the end of the input, silence pushes out whatever the
+		 * latency still holds back. */
+
+		if(samples_in < 1024) {
+			memset(inbuffer + samples_in * 6, 0, (1024 - samples_in) * 6 * sizeof(float));
+			samples_in = 1024;
+		}
+
 		convolver_run(conv, inbuffer, outbuffer, samples_in);
 
-		fwrite(outbuffer, 2 * 4, samples_in, g);
+		/* And the first samples out are from before the input started. */
 
-		samples_written += samples_in;
+		skip = latency < samples_in ? latency : samples_in;
+		latency -= skip;
+
+		samples_out = samples_in - skip;
+		if(samples_out > sample_count - samples_written)
+			samples_out = sample_count - samples_written;
+
+		fwrite(outbuffer + skip * 2, 2 * 4, samples_out, g);
+
+		samples_written += samples_out;
 	}
 
+	convolver_delete(conv);
+	convolver_cleanup();
+
 	fclose(g);
 	fclose(f);
 
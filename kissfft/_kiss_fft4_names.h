@@ -0,0 +1,23 @@
+/* kissfft built again with USE_SIMD, where every scalar is a vector of four
+ * floats, under names of its own, so it links alongside the scalar build.
+ * The types and functions it declares are in kiss_fft4.h. */
+
+#define USE_SIMD
+
+#define kiss_fft_cpx kiss_fft4_cpx
+#define kiss_fft_state kiss_fft4_state
+#define kiss_fft_cfg kiss_fft4_cfg
+#define kiss_fftr_state kiss_fftr4_state
+#define kiss_fftr_cfg kiss_fftr4_cfg
+
+#define kiss_fft kiss_fft4
+#define kiss_fft_alloc kiss_fft4_alloc
+#define kiss_fft_stride kiss_fft4_stride
+#define kiss_fft_cleanup kiss_fft4_cleanup
+#define kiss_fft_next_fast_size kiss_fft4_next_fast_size
+#define kiss_fftr kiss_fftr4
+#define kiss_fftr_alloc kiss_fftr4_alloc
+#define kiss_fftr_work kiss_fftr4_work
+#define kiss_fftr_pruned_work kiss_fftr4_pruned_work
+#define kiss_fftri kiss_fftri4
+#define kiss_fftri_work kiss_fftri4_work
@@ -0,0 +1,4 @@
+#if defined(__SSE__) && defined(__GNUC__)
+#include "_kiss_fft4_names.h"
+#include "kiss_fft.c"
+#endif
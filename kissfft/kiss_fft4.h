@@ -0,0 +1,40 @@
+#ifndef KISS_FFT4_H
+#define KISS_FFT4_H
+
+#include <stddef.h>
+#include <xmmintrin.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ Four transforms at once, one per lane of an SSE vector, from kissfft built
+ with USE_SIMD. Each function is the same as the one without the 4, in
+ kiss_fft.h and kiss_fftr.h. Configurations are allocated with _mm_malloc,
+ so they are freed with kiss_fft4_free.
+ */
+
+typedef struct {
+    __m128 r;
+    __m128 i;
+}kiss_fft4_cpx;
+
+typedef struct kiss_fft4_state* kiss_fft4_cfg;
+typedef struct kiss_fftr4_state* kiss_fftr4_cfg;
+
+kiss_fft4_cfg kiss_fft4_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem);
+void kiss_fft4(kiss_fft4_cfg cfg,const kiss_fft4_cpx *fin,kiss_fft4_cpx *fout);
+
+kiss_fftr4_cfg kiss_fftr4_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem);
+void kiss_fftr4_work(kiss_fftr4_cfg cfg,const __m128 *timedata,kiss_fft4_cpx *freqdata,kiss_fft4_cpx *tmpbuf);
+void kiss_fftri4_work(kiss_fftr4_cfg cfg,const kiss_fft4_cpx *freqdata,__m128 *timedata,kiss_fft4_cpx *tmpbuf);
+void kiss_fftr4_pruned_work(kiss_fftr4_cfg cfg,kiss_fft4_cfg half,const __m128 *timedata,int nonzero,kiss_fft4_cpx *freqdata,kiss_fft4_cpx *tmpbuf);
+
+#define kiss_fft4_free _mm_free
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -65,6 +65,11 @@ kiss_fftr_cfg kiss_fftr_alloc(int nfft,int inverse_fft,void * mem,size_t * lenme
 }
 
 void kiss_fftr(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata)
+{
+    kiss_fftr_work(st, timedata, freqdata, st->tmpbuf);
+}
+
+void kiss_fftr_work(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata,kiss_fft_cpx *tmpbuf)
 {
     /* input buffer timedata is stored row-wise */
     int k,ncfft;
@@ -78,8 +83,8 @@ void kiss_fftr(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *fr
     ncfft = st->substate->nfft;
 
     /*perform the parallel fft of two real signals packed in real,imag*/
-    kiss_fft( st->substate , (const kiss_fft_cpx*)timedata, st->tmpbuf );
-    /* The real part of the DC element of the frequency spectrum in st->tmpbuf
+    kiss_fft( st->substate , (const kiss_fft_cpx*)timedata, tmpbuf );
+    /* The real part of the DC element of the frequency spectrum in tmpbuf
      * contains the sum of the even-numbered elements of the input time sequence
      * The imag part is the sum of the odd-numbered elements
      *
@@ -89,8 +94,92 @@ void kiss_fftr(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *fr
      *      yielding Nyquist bin of input time sequence
      */
  
-    tdc.r = st->tmpbuf[0].r;
-    tdc.i = st->tmpbuf[0].i;
+    tdc.r = tmpbuf[0].r;
+    tdc.i = tmpbuf[0].i;
+    C_FIXDIV(tdc,2);
+    CHECK_OVERFLOW_OP(tdc.r ,+, tdc.i);
+    CHECK_OVERFLOW_OP(tdc.r ,-, tdc.i);
+    freqdata[0].r = tdc.r + tdc.i;
+    freqdata[ncfft].r = tdc.r - tdc.i;
+#ifdef USE_SIMD    
+    freqdata[ncfft].i = freqdata[0].i = _mm_set1_ps(0);
+#else
+    freqdata[ncfft].i = freqdata[0].i = 0;
+#endif
+
+    for ( k=1;k <= ncfft/2 ; ++k ) {
+        fpk    = tmpbuf[k]; 
+        fpnk.r =   tmpbuf[ncfft-k].r;
+        fpnk.i = - tmpbuf[ncfft-k].i;
+        C_FIXDIV(fpk,2);
+        C_FIXDIV(fpnk,2);
+
+        C_ADD( f1k, fpk , fpnk );
+        C_SUB( f2k, fpk , fpnk );
+        C_MUL( tw , f2k , st->super_twiddles[k-1]);
+
+        freqdata[k].r = HALF_OF(f1k.r + tw.r);
+        freqdata[k].i = HALF_OF(f1k.i + tw.i);
+        freqdata[ncfft-k].r = HALF_OF(f1k.r - tw.r);
+        freqdata[ncfft-k].i = HALF_OF(tw.i - f1k.i);
+    }
+}
+
+/* A point of the packed input, past the nonzero points of which is zero */
+static kiss_fft_cpx kf_pruned_load(const kiss_fft_scalar *timedata,int nonzero,int n)
+{
+    kiss_fft_cpx c;
+#ifdef USE_SIMD
+    c.r = c.i = _mm_set1_ps(0);
+#else
+    c.r = c.i = 0;
+#endif
+    if (2 * n < nonzero)
+        c.r = timedata[2 * n];
+    if (2 * n + 1 < nonzero)
+        c.i = timedata[2 * n + 1];
+    return c;
+}
+
+void kiss_fftr_pruned_work(kiss_fftr_cfg st,kiss_fft_cfg half,const kiss_fft_scalar *timedata,int nonzero,kiss_fft_cpx *freqdata,kiss_fft_cpx *tmpbuf)
+{
+    int k,n,m,ncfft;
+    kiss_fft_cpx fpnk,fpk,f1k,f2k,tw,tdc,a,b,t;
+    kiss_fft_cpx *spectrum, *even, *odd;
+
+    if ( st->substate->inverse) {
+        fprintf(stderr,"kiss fft usage error: improper alloc\n");
+        exit(1);
+    }
+
+    ncfft = st->substate->nfft;
+    m = ncfft / 2;
+    spectrum = tmpbuf;
+    even = tmpbuf + ncfft;
+    odd = even + m;
+
+    /* The first radix 2 stage of the packed transform is done here, as a
+     * decimation in frequency, where the points past nonzero are never read,
+     * and the even and odd halves of its output are then transforms of half
+     * its size */
+    for (n = 0; n < m; ++n) {
+        a = kf_pruned_load(timedata, nonzero, n);
+        b = kf_pruned_load(timedata, nonzero, n + m);
+        C_FIXDIV(a,2);
+        C_FIXDIV(b,2);
+        C_ADD(even[n], a, b);
+        C_SUB(t, a, b);
+        C_MUL(odd[n], t, st->substate->twiddles[n]);
+    }
+
+    kiss_fft(half, even, spectrum);
+    kiss_fft(half, odd, spectrum + m);
+
+    /* Then the same as kiss_fftr_work, with the bins in even, odd order */
+#define PRUNED_BIN(k) spectrum[((k) & 1) * m + ((k) >> 1)]
+
+    tdc.r = spectrum[0].r;
+    tdc.i = spectrum[0].i;
     C_FIXDIV(tdc,2);
     CHECK_OVERFLOW_OP(tdc.r ,+, tdc.i);
     CHECK_OVERFLOW_OP(tdc.r ,-, tdc.i);
@@ -103,9 +192,9 @@ void kiss_fftr(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *fr
 #endif
 
     for ( k=1;k <= ncfft/2 ; ++k ) {
-        fpk    = st->tmpbuf[k]; 
-        fpnk.r =   st->tmpbuf[ncfft-k].r;
-        fpnk.i = - st->tmpbuf[ncfft-k].i;
+        fpk    = PRUNED_BIN(k);
+        fpnk.r =   PRUNED_BIN(ncfft-k).r;
+        fpnk.i = - PRUNED_BIN(ncfft-k).i;
         C_FIXDIV(fpk,2);
         C_FIXDIV(fpnk,2);
 
@@ -118,9 +207,16 @@ void kiss_fftr(kiss_fftr_cfg st,const kiss_fft_scalar *timedata,kiss_fft_cpx *fr
         freqdata[ncfft-k].r = HALF_OF(f1k.r - tw.r);
         freqdata[ncfft-k].i = HALF_OF(tw.i - f1k.i);
     }
+
+#undef PRUNED_BIN
 }
 
 void kiss_fftri(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *timedata)
+{
+    kiss_fftri_work(st, freqdata, timedata, st->tmpbuf);
+}
+
+void kiss_fftri_work(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *timedata,kiss_fft_cpx *tmpbuf)
 {
     /* input buffer timedata is stored row-wise */
     int k, ncfft;
@@ -132,9 +228,9 @@ void kiss_fftri(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *t
 
     ncfft = st->substate->nfft;
 
-    st->tmpbuf[0].r = freqdata[0].r + freqdata[ncfft].r;
-    st->tmpbuf[0].i = freqdata[0].r - freqdata[ncfft].r;
-    C_FIXDIV(st->tmpbuf[0],2);
+    tmpbuf[0].r = freqdata[0].r + freqdata[ncfft].r;
+    tmpbuf[0].i = freqdata[0].r - freqdata[ncfft].r;
+    C_FIXDIV(tmpbuf[0],2);
 
     for (k = 1; k <= ncfft / 2; ++k) {
         kiss_fft_cpx fk, fnkc, fek, fok, tmp;
@@ -147,13 +243,13 @@ void kiss_fftri(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *t
         C_ADD (fek, fk, fnkc);
         C_SUB (tmp, fk, fnkc);
         C_MUL (fok, tmp, st->super_twiddles[k-1]);
-        C_ADD (st->tmpbuf[k],     fek, fok);
-        C_SUB (st->tmpbuf[ncfft - k], fek, fok);
+        C_ADD (tmpbuf[k],     fek, fok);
+        C_SUB (tmpbuf[ncfft - k], fek, fok);
 #ifdef USE_SIMD        
-        st->tmpbuf[ncfft - k].i *= _mm_set1_ps(-1.0);
+        tmpbuf[ncfft - k].i *= _mm_set1_ps(-1.0);
 #else
-        st->tmpbuf[ncfft - k].i *= -1;
+        tmpbuf[ncfft - k].i *= -1;
 #endif
     }
-    kiss_fft (st->substate, st->tmpbuf, (kiss_fft_cpx *) timedata);
+    kiss_fft (st->substate, tmpbuf, (kiss_fft_cpx *) timedata);
 }
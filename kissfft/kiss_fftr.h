@@ -38,6 +38,20 @@ void kiss_fftri(kiss_fftr_cfg cfg,const kiss_fft_cpx *freqdata,kiss_fft_scalar *
  output timedata has nfft scalar points
 */
 
+void kiss_fftr_work(kiss_fftr_cfg cfg,const kiss_fft_scalar *timedata,kiss_fft_cpx *freqdata,kiss_fft_cpx *tmpbuf);
+void kiss_fftri_work(kiss_fftr_cfg cfg,const kiss_fft_cpx *freqdata,kiss_fft_scalar *timedata,kiss_fft_cpx *tmpbuf);
+/*
+ The same, with work space of nfft/2 complex points supplied by the caller,
+ so one cfg can be used by several threads at once
+*/
+
+void kiss_fftr_pruned_work(kiss_fftr_cfg cfg,kiss_fft_cfg half,const kiss_fft_scalar *timedata,int nonzero,kiss_fft_cpx *freqdata,kiss_fft_cpx *tmpbuf);
+/*
+ A forward transform of timedata zero padded past its first nonzero points,
+ which are all that is read. half is a complex cfg of nfft/4 points, and the
+ work space holds nfft complex points
+*/
+
 #define kiss_fftr_free free
 
 #ifdef __cplusplus
@@ -0,0 +1,102 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simple_convolver.h"
+
+/* Checks that running an input at a reduced rate gives the same output as
+ * running it at full rate, for input with nothing but low frequencies, like
+ * LFE. The impulse carries energy from its very first sample, which is what
+ * the filter delay would cut off without enough latency. Prints the error of
+ * each case in dB, and fails if any is too large. */
+
+#define INPUTS 6
+#define OUTPUTS 2
+#define LOW_INPUT 3
+#define RATE 48000
+#define IMPULSE 8192
+#define LENGTH (RATE / 2)
+#define CHUNK 1000
+#define LIMIT -50.0
+
+static void run(void *conv, const float *in, float *out) {
+	int i;
+
+	for(i = 0; i < LENGTH; i += CHUNK)
+		convolver_run(conv, in + i * INPUTS, out + i * OUTPUTS, CHUNK);
+}
+
+int main(void) {
+	static const int factors[] = { 8, 16 };
+	static const int latencies[] = { 0, 256, 2048 };
+	float *impulse[INPUTS];
+	float *in, *full, *low;
+	unsigned int seed = 1;
+	int failed = 0;
+	unsigned int i, j;
+	int k;
+
+	in = (float *)calloc(LENGTH * INPUTS, sizeof(float));
+	full = (float *)malloc(sizeof(float) * LENGTH * OUTPUTS);
+	low = (float *)malloc(sizeof(float) * LENGTH * OUTPUTS);
+	if(!in || !full || !low)
+		return 1;
+
+	for(i = 0; i < INPUTS; ++i) {
+		if((impulse[i] = (float *)malloc(sizeof(float) * IMPULSE * OUTPUTS)) == NULL)
+			return 1;
+		for(j = 0; j < IMPULSE * OUTPUTS; ++j) {
+			seed = seed * 1103515245 + 12345;
+			impulse[i][j] = ((float)((seed >> 16) & 0x7fff) / 16384.0f - 1.0f) * expf(-(float)j / 4096.0f);
+		}
+	}
+
+	/* A few tones well within the passband of the filters, at the largest
+	 * factor checked. */
+
+	for(i = 0; i < LENGTH; ++i) {
+		float t = (float)i / RATE;
+		in[i * INPUTS + LOW_INPUT] = 0.3f * sinf(2.0f * (float)M_PI * 25.0f * t) + 0.2f * sinf(2.0f * (float)M_PI * 50.0f * t + 1.0f) + 0.1f * sinf(2.0f * (float)M_PI * 90.0f * t + 2.0f);
+	}
+
+	for(i = 0; i < sizeof(factors) / sizeof(factors[0]); ++i) {
+		for(j = 0; j < sizeof(latencies) / sizeof(latencies[0]); ++j) {
+			convolver_options options;
+			void *conv;
+			double error = 0.0, total = 0.0, db;
+
+			memset(&options, 0, sizeof(options));
+			options.latency = latencies[j];
+
+			if((conv = convolver_create_ex((const float *const *)impulse, IMPULSE, INPUTS, OUTPUTS, 2, &options)) == NULL)
+				return 1;
+			run(conv, in, full);
+			convolver_delete(conv);
+
+			options.lowpass_inputs = 1u << LOW_INPUT;
+			options.lowpass_factor = factors[i];
+
+			if((conv = convolver_create_ex((const float *const *)impulse, IMPULSE, INPUTS, OUTPUTS, 2, &options)) == NULL)
+				return 1;
+			run(conv, in, low);
+			convolver_delete(conv);
+
+			/* Only once the whole impulse is running, as the tones start
+			 * abruptly, which the filters smear. */
+
+			for(k = (IMPULSE + 4096) * OUTPUTS; k < LENGTH * OUTPUTS; ++k) {
+				double d = (double)low[k] - (double)full[k];
+				error += d * d;
+				total += (double)full[k] * (double)full[k];
+			}
+
+			db = 10.0 * log10(error / total + 1e-30);
+			printf("factor %2d latency %4d: %7.1f dB\n", factors[i], latencies[j], db);
+			if(db > LIMIT)
+				failed = 1;
+		}
+	}
+
+	return failed;
+}
@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "simple_convolver.h"
+
 #define _countof(d) (sizeof((d)) / sizeof(((d)[0])))
 
 static const int actual_frequencies[] = { 8000, 11025, 16000, 22050, 32000, 44100, 48000 };
@@ -11,7 +13,8 @@ static const int frequency_count = _countof(frequencies);
 static const char *speakers[] = { "FL", "FR", "FC", "LFE", "BL", "BR" };
 static const int speaker_count = _countof(speakers);
 
-static int sample_counts[frequency_count];
+static int sample_counts[3][_countof(frequencies)];
+static int speaker_sizes[3][_countof(frequencies)][_countof(speakers)];
 
 static const int impulse_wav_size = 524332;
 
@@ -129,22 +132,131 @@ void fprint_float(FILE *f, float value) {
 	}
 }
 
-int main(void) {
+/* Cut each speaker's tail where it falls below the given level, fading out
+ * over the end of what's kept, and write that back over the samples, with
+ * silence after. Each speaker keeps no more than it has already. */
+
+void trim_tails(unsigned char *const *buffer, const int *data_offset, int sample_count, float db, int *sizes) {
+	float *impulse;
+	int speaker, sample;
+
+	impulse = (float *)malloc(sizeof(float) * sample_count * 2);
+
+	for(speaker = 0; speaker < speaker_count; ++speaker) {
+		int size;
+
+		for(sample = 0; sample < sample_count * 2; ++sample) {
+			unsigned int i = filter_sample(buffer[speaker] + data_offset[speaker] + sample * 4);
+			memcpy(&impulse[sample], &i, sizeof(float));
+		}
+
+		size = convolver_trim(&impulse, sample_count, 1, 2, 2, db);
+		if(size < sizes[speaker]) sizes[speaker] = size;
+
+		for(sample = 0; sample < sample_count * 2; ++sample) {
+			unsigned int i = 0;
+			if(sample < sizes[speaker] * 2) memcpy(&i, &impulse[sample], sizeof(i));
+			set_le32(buffer[speaker] + data_offset[speaker] + sample * 4, i);
+		}
+	}
+
+	free(impulse);
+}
+
+/* The spectra record how the FFT library that staged them lays them out, and
+ * dh2 only wraps them with a library that lays them out the same, or stages
+ * the impulses itself where none does. */
+
+int print_spectra(FILE *f, int level, const unsigned char *const *buffer, const int *data_offset, int sample_count, const convolver_options *options) {
+	float *impulse[speaker_count];
+	float *spectra;
+	void *impulses;
+	int speaker, sample, count;
+
+	for(speaker = 0; speaker < speaker_count; ++speaker) {
+		impulse[speaker] = (float *)malloc(sizeof(float) * sample_count * 2);
+		for(sample = 0; sample < sample_count * 2; ++sample) {
+			unsigned int i = filter_sample(buffer[speaker] + data_offset[speaker] + sample * 4);
+			memcpy(&impulse[speaker][sample], &i, sizeof(float));
+		}
+	}
+
+	impulses = convolver_impulses_create((const float *const *)impulse, sample_count, speaker_count, 2, 2, options);
+
+	for(speaker = 0; speaker < speaker_count; ++speaker) {
+		free(impulse[speaker]);
+	}
+
+	if(!impulses) return -1;
+
+	count = convolver_impulses_export(impulses, NULL);
+	spectra = (float *)malloc(sizeof(float) * count);
+	convolver_impulses_export(impulses, spectra);
+	convolver_impulses_release(impulses);
+
+	fprintf(f, "static const unsigned int spectra_l%u[%u] = {\n", level, count);
+	for(sample = 0; sample < count; ++sample) {
+		unsigned int i;
+		memcpy(&i, &spectra[sample], sizeof(i));
+		if((sample & 7) == 0) fprintf(f, "\t");
+		fprintf(f, "0x%08x, ", i);
+		if((sample & 7) == 7) fprintf(f, "\n");
+	}
+	if(count & 7) fprintf(f, "\n");
+	fprintf(f, "};\n\n");
+
+	free(spectra);
+
+	return count;
+}
+
+int main(int argc, char **argv) {
 	int level, frequency, speaker, sample;
 	int min_sample, max_sample, sample_count;
 	int data_offset, data_size;
+	int spectra_frequency = 0, spectra_counts[3] = { 0, 0, 0 };
+	float trim_db = 0.0f;
+	convolver_options spectra_options;
 	FILE *f;
 	char name[128];
 	unsigned char *buffer[speaker_count];
+	int offsets[speaker_count];
+
+	/* Optionally, the impulses for one sample rate are also transformed
+	 * ahead of time, for the given block size and latency. */
+
+	memset(&spectra_options, 0, sizeof(spectra_options));
+
+	/* The tails can also be cut where they fall below a level in dB, instead
+	 * of only where they're silent. */
+
+	if(argc >= 3 && !strcmp(argv[1], "-t")) {
+		trim_db = (float)atof(argv[2]);
+		argv += 2;
+		argc -= 2;
+	}
+
+	if(argc >= 3 && !strcmp(argv[1], "-s")) {
+		spectra_frequency = atoi(argv[2]);
+		if(argc >= 4) spectra_options.block_size = atoi(argv[3]);
+		if(argc >= 5) spectra_options.latency = atoi(argv[4]);
+	} else if(argc != 1) {
+		fprintf(stderr, "Usage:\tsample_trim [-t <dB>] [-s <frequency> [block size [latency]]]\n");
+		return 1;
+	}
 
-	fprintf(stdout, "typedef struct speaker_impulses\n{\n\tunsigned int count;\n\tconst float * impulse[%u];\n} speaker_impulses;\n\n", speaker_count);
+	fprintf(stdout, "typedef struct speaker_impulses\n{\n\tunsigned int count;\n\tint sizes[%u];\n\tconst float * impulse[%u];\n} speaker_impulses;\n\n", speaker_count, speaker_count);
 
 	for(speaker = 0; speaker < speaker_count; ++speaker) {
 		buffer[speaker] = (unsigned char *)malloc(impulse_wav_size);
 	}
 
+	/* Each speaker only keeps as much as it needs, but they all start where
+	 * the first of them does, to stay lined up. */
+
 	for(level = 1; level <= 3; ++level) {
 		for(frequency = 0; frequency < frequency_count; ++frequency) {
+			int *sizes = speaker_sizes[level - 1][frequency];
 			min_sample = 0x7fffffff;
 			max_sample = 0;
 			for(speaker = 0; speaker < speaker_count; ++speaker) {
@@ -173,9 +285,27 @@ int main(void) {
 				}
 
 				if(sample > max_sample) max_sample = sample;
+
+				sizes[speaker] = sample + 1;
+				offsets[speaker] = data_offset;
+			}
+
+			for(speaker = 0; speaker < speaker_count; ++speaker) {
+				sizes[speaker] -= min_sample;
+				if(sizes[speaker] < 1) sizes[speaker] = 1;
+			}
+
+			if(trim_db != 0.0f) {
+				for(speaker = 0; speaker < speaker_count; ++speaker)
+					offsets[speaker] += min_sample * 8;
+				trim_tails(buffer, offsets, max_sample - min_sample + 1, trim_db, sizes);
+				max_sample = min_sample;
+				for(speaker = 0; speaker < speaker_count; ++speaker) {
+					if(min_sample + sizes[speaker] - 1 > max_sample) max_sample = min_sample + sizes[speaker] - 1;
+				}
 			}
 
-			sample_counts[frequency] = max_sample - min_sample + 1;
+			sample_counts[level - 1][frequency] = max_sample - min_sample + 1;
 
 			for(speaker = 0; speaker < speaker_count; ++speaker) {
 				sprintf(name, "samples/trimmed/sample_%u_%s_dh%u.wav", frequencies[frequency], speakers[speaker], level);
@@ -187,8 +317,8 @@ int main(void) {
 
 			for(speaker = 0; speaker < speaker_count; ++speaker) {
 				find_data(buffer[speaker], impulse_wav_size, &data_offset, &data_size);
-				fprintf(stdout, "static const unsigned int impulse_l%u_%u_%s[%u * 2] = {\n", level, frequencies[frequency], speakers[speaker], max_sample - min_sample + 1);
-				for(sample = min_sample; sample <= max_sample; ++sample) {
+				fprintf(stdout, "static const unsigned int impulse_l%u_%u_%s[%u * 2] = {\n", level, frequencies[frequency], speakers[speaker], sizes[speaker]);
+				for(sample = min_sample; sample < min_sample + sizes[speaker]; ++sample) {
 					unsigned int i;
 					if(((sample - min_sample) & 3) == 0) fprintf(stdout, "\t");
 					i = filter_sample(buffer[speaker] + data_offset + sample * 8);
@@ -197,15 +327,29 @@ int main(void) {
 					fprintf(stdout, "0x%08x, ", i);
 					if(((sample - min_sample) & 3) == 3) fprintf(stdout, "\n");
 				}
-				if((max_sample - min_sample + 1) & 3) fprintf(stdout, "\n");
+				if(sizes[speaker] & 3) fprintf(stdout, "\n");
 				fprintf(stdout, "};\n\n");
+
+				offsets[speaker] = data_offset + min_sample * 8;
+			}
+
+			if(actual_frequencies[frequency] == spectra_frequency) {
+				spectra_counts[level - 1] = print_spectra(stdout, level, (const unsigned char *const *)buffer, offsets, max_sample - min_sample + 1, &spectra_options);
+				if(spectra_counts[level - 1] < 0) {
+					fprintf(stderr, "Unable to transform impulses at %u Hz.\n", spectra_frequency);
+					return 1;
+				}
 			}
 		}
 	}
 
 	for(level = 1; level <= 3; ++level) {
 		for(frequency = 0; frequency < frequency_count; ++frequency) {
-			fprintf(stdout, "static const speaker_impulses impulses_l%u_%u = {\n\t%u,\n\t{\n", level, frequencies[frequency], sample_counts[frequency]);
+			fprintf(stdout, "static const speaker_impulses impulses_l%u_%u = {\n\t%u,\n\t{ ", level, frequencies[frequency], sample_counts[level - 1][frequency]);
+
+			for(speaker = 0; speaker < speaker_count; ++speaker) {
+				fprintf(stdout, "%u%s", speaker_sizes[level - 1][frequency][speaker], speaker < speaker_count - 1 ? ", " : " },\n\t{\n");
+			}
 
 			for(speaker = 0; speaker < speaker_count; ++speaker) {
 				fprintf(stdout, "\t\t(const float *)&impulse_l%u_%u_%s%s\n", level, frequencies[frequency], speakers[speaker], speaker < speaker_count - 1 ? "," : "");
@@ -229,6 +373,19 @@ int main(void) {
 		fprintf(stdout, "\t}%s\n", level < 3 ? "," : "");
 	}
 
+	fprintf(stdout, "};\n\n");
+
+	fprintf(stdout, "typedef struct speaker_spectra\n{\n\tunsigned int frequency;\n\tunsigned int count;\n\tconst float * spectra;\n} speaker_spectra;\n\n");
+
+	fprintf(stdout, "static const speaker_spectra speaker_spectra_sets[3] =\n{\n");
+
+	for(level = 1; level <= 3; ++level) {
+		if(spectra_counts[level - 1])
+			fprintf(stdout, "\t{ %u, %u, (const float *)&spectra_l%u }%s\n", spectra_frequency, spectra_counts[level - 1], level, level < 3 ? "," : "");
+		else
+			fprintf(stdout, "\t{ 0, 0, 0 }%s\n", level < 3 ? "," : "");
+	}
+
 	fprintf(stdout, "};\n");
 
 	return 0;
@@ -32,688 +32,3656 @@
  * around various parts of the Internet. I chose to use kissfft because it's
  * fairly fast, and also under a less restrictive license than FFTW. */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* for pinning threads */
+#endif
+
 #include "simple_convolver.h"
 
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* Here comes the magic import header! */
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
 
+/* Here comes the magic import header! kissfft and the built in transforms are
+ * always there, FFTW when asked for, and vDSP on Apple, and which of them runs
+ * is picked at runtime. */
+
+#include <time.h>
+
+#include "kissfft/kiss_fftr.h"
+#include "splitfft/splitfft.h"
+#if defined(__SSE__) && defined(__GNUC__)
+#include "kissfft/kiss_fft4.h"
+#define CONVOLVER_KISS4
+#endif
 #ifdef USE_FFTW
 #include <fftw3.h>
-#elif defined(__APPLE__)
+#endif
+#ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
-#include <mm_malloc.h>
+#define CONVOLVER_VDSP
+#endif
+
+/* Spectra on x86 get vector kernels for the products, with the widest one the
+ * CPU supports picked at runtime. On Apple, vDSP brings its own, whichever
+ * library transforms them. */
+
+#if !defined(CONVOLVER_VDSP) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CONVOLVER_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/* A single spectrum, with its real and imaginary parts in separate planes, as
+ * vDSP keeps them, so the products don't need to shuffle pairs around. Each
+ * plane holds half the FFT size bins, with the Nyquist bin packed into the
+ * imaginary part of the DC bin, which would otherwise always be zero. Other
+ * libraries are converted to this when transforming. */
+
+#ifdef CONVOLVER_VDSP
+typedef DSPSplitComplex convolver_spectrum;
 #else
-#include "kissfft/kiss_fftr.h"
+typedef struct convolver_spectrum {
+	float *realp;
+	float *imagp;
+} convolver_spectrum;
 #endif
 
-#ifdef __APPLE__
-#define _mm_malloc(a, b) _memalign_malloc(a, b)
-static void *_memalign_malloc(size_t size, size_t align) {
-	void *ret = NULL;
-	if(posix_memalign(&ret, align, size) != 0) {
-		return NULL;
+/* The same, stored as 16 bit floats, which are scaled by a power of two to
+ * make the most of their range, and scaled back as they are converted. */
+
+typedef struct convolver_half_spectrum {
+	unsigned short *realp;
+	unsigned short *imagp;
+	float scale;
+} convolver_half_spectrum;
+
+/* Everything an instance holds on to comes out of a single block, and so does
+ * each impulse set, as they can outlive it. The block is sized by carving it
+ * up once without it, where every piece comes back NULL, then allocated, and
+ * carved up the same way again. Every piece starts on a cache line of its own,
+ * and is cleared. */
+
+#define CONVOLVER_ALIGN 64 /* alignment of every piece */
+#define CONVOLVER_HUGE_PAGE (2 << 20) /* smallest huge page, and smallest block mapped to them */
+
+typedef struct convolver_arena {
+	char *base; /* the block, or NULL while sizing */
+	size_t size; /* carved out so far */
+	size_t mapped; /* length mapped, when mapped instead of allocated */
+} convolver_arena;
+
+static void *_arena_take(convolver_arena *arena, size_t size) {
+	void *ret = arena->base ? arena->base + arena->size : NULL;
+	arena->size += (size + CONVOLVER_ALIGN - 1) & ~(size_t)(CONVOLVER_ALIGN - 1);
+	return ret;
+}
+
+static float *_arena_floats(convolver_arena *arena, size_t count) {
+	return (float *)_arena_take(arena, sizeof(float) * count);
+}
+
+/* The planes have room for one more bin, where FFTW puts the Nyquist bin
+ * before it's packed. */
+
+static void _arena_spectrum(convolver_arena *arena, convolver_spectrum *out, int fftlen) {
+	out->realp = _arena_floats(arena, fftlen / 2 + 1);
+	out->imagp = _arena_floats(arena, fftlen / 2 + 1);
+}
+
+static convolver_spectrum *_arena_spectra(convolver_arena *arena, int count, int fftlen) {
+	convolver_spectrum *ret = (convolver_spectrum *)_arena_take(arena, sizeof(convolver_spectrum) * count);
+	convolver_spectrum sizing;
+	int i;
+	for(i = 0; i < count; ++i)
+		_arena_spectrum(arena, ret ? &ret[i] : &sizing, fftlen);
+	return ret;
+}
+
+static float **_arena_buffers(convolver_arena *arena, int count, size_t length) {
+	float **ret = (float **)_arena_take(arena, sizeof(float *) * count);
+	int i;
+	for(i = 0; i < count; ++i) {
+		float *buffer = _arena_floats(arena, length);
+		if(ret)
+			ret[i] = buffer;
+	}
+	return ret;
+}
+
+/* Both planes of a half spectrum share one piece, without the extra bin, as
+ * they are only ever converted from packed spectra. */
+
+static convolver_half_spectrum *_arena_half_spectra(convolver_arena *arena, int count, int fftlen) {
+	convolver_half_spectrum *ret = (convolver_half_spectrum *)_arena_take(arena, sizeof(convolver_half_spectrum) * count);
+	int i;
+	for(i = 0; i < count; ++i) {
+		unsigned short *planes = (unsigned short *)_arena_take(arena, sizeof(unsigned short) * fftlen);
+		if(ret) {
+			ret[i].realp = planes;
+			ret[i].imagp = planes + fftlen / 2;
+			ret[i].scale = 1.0f;
+		}
+	}
+	return ret;
+}
+
+/* With huge pages, on Linux, large blocks are mapped from the reserved pool,
+ * or failing that, mapped on a huge page boundary, and advised to be backed
+ * by transparent huge pages. Anything else comes from the heap. */
+
+static int _arena_open(convolver_arena *arena, int huge) {
+	size_t size = arena->size;
+	void *base;
+
+	arena->size = 0;
+	arena->mapped = 0;
+
+#ifdef __linux__
+	if(huge && size >= CONVOLVER_HUGE_PAGE) {
+		size_t length = (size + CONVOLVER_HUGE_PAGE - 1) & ~(size_t)(CONVOLVER_HUGE_PAGE - 1);
+#ifdef MAP_HUGETLB
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(base != MAP_FAILED) {
+			arena->base = (char *)base;
+			arena->mapped = length;
+			return 0;
+		}
+#endif
+		base = mmap(NULL, length + CONVOLVER_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(base != MAP_FAILED) {
+			char *start = (char *)base;
+			size_t lead = (CONVOLVER_HUGE_PAGE - ((size_t)start & (CONVOLVER_HUGE_PAGE - 1))) & (CONVOLVER_HUGE_PAGE - 1);
+			if(lead)
+				munmap(start, lead);
+			munmap(start + lead + length, CONVOLVER_HUGE_PAGE - lead);
+#ifdef MADV_HUGEPAGE
+			madvise(start + lead, length, MADV_HUGEPAGE);
+#endif
+			arena->base = start + lead;
+			arena->mapped = length;
+			return 0;
+		}
+	}
+#else
+	(void)huge;
+#endif
+
+	if(posix_memalign(&base, CONVOLVER_ALIGN, size) != 0)
+		return -1;
+	memset(base, 0, size);
+	arena->base = (char *)base;
+	return 0;
+}
+
+/* The arena may live in its own block, so it is copied out first. */
+
+static void _arena_close(convolver_arena arena) {
+#ifdef __linux__
+	if(arena.mapped) {
+		munmap(arena.base, arena.mapped);
+		return;
+	}
+#endif
+	free(arena.base);
+}
+
+static size_t _arena_footprint(const convolver_arena *arena) {
+	return arena->mapped ? arena->mapped : arena->size;
+}
+
+/* Transforms are planned once per size and library for the whole process,
+ * and shared by every instance and worker, as none of the libraries write to
+ * their plans while transforming. kissfft only does so to its own work space,
+ * which each worker supplies instead. Planning itself isn't thread safe with
+ * FFTW, so everything to do with plans, wisdom and picking the library
+ * included, happens under one lock. */
+
+#define CONVOLVER_MAX_PLANS 32 /* one per log2 of the FFT size */
+
+/* What sets the libraries apart, beyond how fast they are. Spectra can only
+ * be shared between libraries that lay them out alike, as the format says.
+ * vDSP doubles the output of each forward transform, and the others scale by
+ * the size only. Some read only as much input as there is, and skip the work
+ * the zero padding past it would take, while the others need it zeroed. And
+ * some transform more than one channel at a time, for less than each alone. */
+
+#define CONVOLVER_MAX_BATCH 4 /* channels transformed at once */
+
+typedef struct convolver_fft {
+	const char *name; /* as given in the environment */
+	int format; /* layout of the spectra, as exported */
+	float gain; /* scale of a round trip, past the size */
+	int pruned; /* reads only the input given */
+	int batch; /* channels transformed at once */
+} convolver_fft;
+
+static const convolver_fft _ffts[CONVOLVER_FFT_COUNT] = {
+	{ "auto", 0, 0.0f, 0, 0 },
+	{ "kiss", 1, 1.0f, 1, 2 },
+	{ "fftw", 1, 1.0f, 0, 1 },
+	{ "vdsp", 2, 4.0f, 0, 1 },
+	{ "split", 3, 1.0f, 1, 1 },
+	{ "kiss4", 1, 1.0f, 1, 4 },
+};
+
+#define CONVOLVER_SPECTRA_FORMATS 4 /* any, then each of the above */
+
+static int _fft_available(int fft) {
+	switch(fft) {
+	case CONVOLVER_FFT_KISS:
+	case CONVOLVER_FFT_SPLIT:
+		return 1;
+#ifdef USE_FFTW
+	case CONVOLVER_FFT_FFTW:
+		return 1;
+#endif
+#ifdef CONVOLVER_VDSP
+	case CONVOLVER_FFT_VDSP:
+		return 1;
+#endif
+#ifdef CONVOLVER_KISS4
+	case CONVOLVER_FFT_KISS4:
+		return 1;
+#endif
+	default:
+		return 0;
 	}
+}
+
+typedef struct convolver_plan {
+	int fft; /* library, or zero until planned */
+	int fftlenlog2; /* log2 of the FFT size */
+	int refs; /* instances and impulse sets using it, updated atomically */
+	kiss_fftr_cfg kiss_fw, kiss_bw; /* kissfft forward and backwards instances */
+	kiss_fft_cfg kiss_cfw, kiss_cbw; /* the same, complex, for pairs of channels */
+	kiss_fft_cfg kiss_qfw; /* quarter size forward, for zero padded input */
+#ifdef CONVOLVER_KISS4
+	kiss_fftr4_cfg kiss4_fw, kiss4_bw; /* the same three, four channels at once, with SSE */
+	kiss_fft4_cfg kiss4_qfw;
+#endif
+	splitfft_setup *split; /* built in transforms, both ways */
+#ifdef USE_FFTW
+	fftwf_plan fw, bw; /* FFTW forward and backwards plans */
+#endif
+#ifdef CONVOLVER_VDSP
+	FFTSetup setup; /* vDSP setup */
+#endif
+} convolver_plan;
+
+static pthread_mutex_t _plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static convolver_plan _plans[CONVOLVER_FFT_COUNT][CONVOLVER_MAX_PLANS];
+static int _plan_effort = CONVOLVER_PLAN_ESTIMATE;
+
+/* The library to use, as set by the caller, or from the environment, and
+ * otherwise the fastest for each size, and each format it must produce. */
+
+static int _fft_choice = -1;
+static int _fft_best[CONVOLVER_SPECTRA_FORMATS][CONVOLVER_MAX_PLANS];
+
+static void _plan_free(convolver_plan *plan) {
+	if(plan->kiss_fw)
+		kiss_fftr_free(plan->kiss_fw);
+	if(plan->kiss_bw)
+		kiss_fftr_free(plan->kiss_bw);
+	if(plan->kiss_cfw)
+		kiss_fft_free(plan->kiss_cfw);
+	if(plan->kiss_cbw)
+		kiss_fft_free(plan->kiss_cbw);
+	if(plan->kiss_qfw)
+		kiss_fft_free(plan->kiss_qfw);
+#ifdef CONVOLVER_KISS4
+	if(plan->kiss4_fw)
+		kiss_fft4_free(plan->kiss4_fw);
+	if(plan->kiss4_bw)
+		kiss_fft4_free(plan->kiss4_bw);
+	if(plan->kiss4_qfw)
+		kiss_fft4_free(plan->kiss4_qfw);
+#endif
+	if(plan->split)
+		splitfft_destroy(plan->split);
+#ifdef USE_FFTW
+	if(plan->fw)
+		fftwf_destroy_plan(plan->fw);
+	if(plan->bw)
+		fftwf_destroy_plan(plan->bw);
+#endif
+#ifdef CONVOLVER_VDSP
+	if(plan->setup)
+		vDSP_destroy_fftsetup(plan->setup);
+#endif
+	memset(plan, 0, sizeof(*plan));
+}
+
+/* FFTW plans are made against buffers of their own, which measuring may
+ * scribble over, then executed on others, which are all carved out with the
+ * same alignment. */
+
+#ifdef USE_FFTW
+static int _plan_make_fftw(convolver_plan *plan, int fftlenlog2) {
+	int fftlen = 1 << fftlenlog2;
+	static const unsigned int flags[] = { FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT };
+	unsigned int flag = flags[_plan_effort];
+	convolver_arena arena = { NULL, 0, 0 };
+	convolver_spectrum spectrum;
+	float *buffer;
+	fftwf_iodim dim;
+	int ret = -1;
+
+	_arena_floats(&arena, fftlen);
+	_arena_spectrum(&arena, &spectrum, fftlen);
+	if(_arena_open(&arena, 0) < 0)
+		return -1;
+	buffer = _arena_floats(&arena, fftlen);
+	_arena_spectrum(&arena, &spectrum, fftlen);
+
+	dim.n = fftlen;
+	dim.is = 1;
+	dim.os = 1;
+	plan->fw = fftwf_plan_guru_split_dft_r2c(1, &dim, 0, NULL, buffer, spectrum.realp, spectrum.imagp, flag);
+	plan->bw = fftwf_plan_guru_split_dft_c2r(1, &dim, 0, NULL, spectrum.realp, spectrum.imagp, buffer, flag);
+	if(plan->fw && plan->bw)
+		ret = 0;
+
+	_arena_close(arena);
 	return ret;
 }
-#define _mm_free(a) free(a)
 #endif
 
-#if !defined(USE_FFTW) && defined(__APPLE__)
-static inline int _malloc_dspsplitcomplex(DSPSplitComplex *out, size_t fftlen) {
-	fftlen = (fftlen / 2) + 1;
-	out->realp = _mm_malloc(sizeof(float) * fftlen, 16);
-	out->imagp = _mm_malloc(sizeof(float) * fftlen, 16);
-	if(out->realp == NULL || out->imagp == NULL) return -1;
+static int _plan_make(convolver_plan *plan, int fft, int fftlenlog2) {
+	int fftlen = 1 << fftlenlog2;
+
+	switch(fft) {
+#ifdef CONVOLVER_KISS4
+	case CONVOLVER_FFT_KISS4:
+		if((plan->kiss4_fw = kiss_fftr4_alloc(fftlen, 0, NULL, NULL)) == NULL)
+			return -1;
+		if((plan->kiss4_bw = kiss_fftr4_alloc(fftlen, 1, NULL, NULL)) == NULL)
+			return -1;
+		if((plan->kiss4_qfw = kiss_fft4_alloc(fftlen / 4, 0, NULL, NULL)) == NULL)
+			return -1;
+		/* A channel left over from a batch runs on its own, through the
+		 * plain build. */
+		if(_plan_make(plan, CONVOLVER_FFT_KISS, fftlenlog2) < 0)
+			return -1;
+		break;
+#endif
+	case CONVOLVER_FFT_KISS:
+		if((plan->kiss_fw = kiss_fftr_alloc(fftlen, 0, NULL, NULL)) == NULL)
+			return -1;
+		if((plan->kiss_bw = kiss_fftr_alloc(fftlen, 1, NULL, NULL)) == NULL)
+			return -1;
+		if((plan->kiss_cfw = kiss_fft_alloc(fftlen, 0, NULL, NULL)) == NULL)
+			return -1;
+		if((plan->kiss_cbw = kiss_fft_alloc(fftlen, 1, NULL, NULL)) == NULL)
+			return -1;
+		if((plan->kiss_qfw = kiss_fft_alloc(fftlen / 4, 0, NULL, NULL)) == NULL)
+			return -1;
+		break;
+	case CONVOLVER_FFT_SPLIT:
+		if((plan->split = splitfft_create(fftlenlog2)) == NULL)
+			return -1;
+		break;
+#ifdef USE_FFTW
+	case CONVOLVER_FFT_FFTW:
+		if(_plan_make_fftw(plan, fftlenlog2) < 0)
+			return -1;
+		break;
+#endif
+#ifdef CONVOLVER_VDSP
+	case CONVOLVER_FFT_VDSP:
+		if((plan->setup = vDSP_create_fftsetup(fftlenlog2, FFT_RADIX2)) == NULL)
+			return -1;
+		break;
+#endif
+	default:
+		return -1;
+	}
+
+	plan->fft = fft;
+	plan->fftlenlog2 = fftlenlog2;
+	return 0;
+}
+
+/* Plans are made on first use, and kept until cleanup finds them unused.
+ * Called with the lock held. */
+
+static convolver_plan *_plan_get(int fft, int fftlenlog2) {
+	convolver_plan *plan = &_plans[fft][fftlenlog2];
+
+	if(!plan->fft) {
+		_plan_free(plan);
+		if(_plan_make(plan, fft, fftlenlog2) < 0) {
+			_plan_free(plan);
+			return NULL;
+		}
+	}
+
+	return plan;
+}
+
+int convolver_set_fft(int fft) {
+	if(fft != CONVOLVER_FFT_AUTO && !_fft_available(fft))
+		return -1;
+	pthread_mutex_lock(&_plan_lock);
+	_fft_choice = fft;
+	pthread_mutex_unlock(&_plan_lock);
 	return 0;
 }
 
-static inline void _free_dspsplitcomplex(DSPSplitComplex *cpx) {
-	if(cpx->realp) _mm_free(cpx->realp);
-	if(cpx->imagp) _mm_free(cpx->imagp);
+/* Unless set otherwise, the environment may name the library to use. Names it
+ * doesn't know, or libraries that aren't built in, leave it to timing. */
+
+static void _fft_choose(void) {
+	const char *name;
+	int i;
+
+	if(_fft_choice >= 0)
+		return;
+
+	_fft_choice = CONVOLVER_FFT_AUTO;
+	if((name = getenv("CONVOLVER_FFT")) == NULL)
+		return;
+	for(i = 1; i < CONVOLVER_FFT_COUNT; ++i) {
+		if(!strcmp(name, _ffts[i].name) && _fft_available(i))
+			_fft_choice = i;
+	}
+}
+
+void convolver_set_planning(int effort) {
+	if(effort < CONVOLVER_PLAN_ESTIMATE || effort > CONVOLVER_PLAN_PATIENT)
+		return;
+	pthread_mutex_lock(&_plan_lock);
+	_plan_effort = effort;
+	pthread_mutex_unlock(&_plan_lock);
+}
+
+int convolver_load_wisdom(const char *path) {
+	int ret = -1;
+#ifdef USE_FFTW
+	pthread_mutex_lock(&_plan_lock);
+	if(fftwf_import_wisdom_from_filename(path))
+		ret = 0;
+	pthread_mutex_unlock(&_plan_lock);
+#else
+	(void)path;
+#endif
+	return ret;
 }
+
+int convolver_save_wisdom(const char *path) {
+	int ret = -1;
+#ifdef USE_FFTW
+	pthread_mutex_lock(&_plan_lock);
+	if(fftwf_export_wisdom_to_filename(path))
+		ret = 0;
+	pthread_mutex_unlock(&_plan_lock);
+#else
+	(void)path;
 #endif
+	return ret;
+}
 
-/* Only the simplest of state information is necessary for this, and it's
- * designed around a simple usage case. As many samples as you can generate,
- * input one at a time, and output pulled one at a time as well. */
+/* Every instance and impulse set holds a reference on each plan it runs, so
+ * cleanup can leave those alone. References are only taken with the lock
+ * held, or on top of one already held, so a plan found unused here stays
+ * that way. */
 
-typedef struct convolver_state {
-	int fftlen; /* size of FFT */
-	int impulselen; /* size of impulse */
-	int fftlenover2; /* half size of FFT, rounded up */
-#if !defined(USE_FFTW) && defined(__APPLE__)
+static void _plan_hold(convolver_plan *plan) {
+	__sync_add_and_fetch(&plan->refs, 1);
+}
+
+static void _plan_drop(convolver_plan *plan) {
+	if(plan)
+		__sync_sub_and_fetch(&plan->refs, 1);
+}
+
+void convolver_cleanup(void) {
+	int i, j;
+	pthread_mutex_lock(&_plan_lock);
+	for(i = 0; i < CONVOLVER_FFT_COUNT; ++i) {
+		for(j = 0; j < CONVOLVER_MAX_PLANS; ++j) {
+			if(!__sync_fetch_and_add(&_plans[i][j].refs, 0))
+				_plan_free(&_plans[i][j]);
+		}
+	}
+	memset(_fft_best, 0, sizeof(_fft_best));
+	pthread_mutex_unlock(&_plan_lock);
+}
+
+/* The impulses are split into partitions, and every partition is transformed
+ * with an FFT of twice its size. The input is run through the same size
+ * transform, over a window holding the previous block and the block being
+ * filled, and every transformed block is kept in a delay line as deep as
+ * there are partitions. The output of a block is then the inverse transform
+ * of the sum of each partition multiplied by the input block that lines up
+ * with it, of which only the second half is kept. This way, the cost of a
+ * block grows with the number of partitions, instead of with a transform as
+ * large as the whole impulse.
+ *
+ * Partitions come in segments of growing size, after Gardner. The head of
+ * the impulse uses small partitions, so output is ready early, and each
+ * segment after it doubles the partition size, so the long tail costs a few
+ * large transforms instead of many small ones. A block of a later segment is
+ * only complete once all of its input has arrived, so that segment must start
+ * far enough into the impulse for its output not to be due yet.
+ *
+ * Without any latency, the head segment sums the products of its older
+ * partitions once, when the previous block completes, as they don't depend
+ * on the block being filled. This leaves only the first partition to multiply
+ * in for each call, which is what lets partial blocks be output right away. */
+
+#define CONVOLVER_HEAD_SIZE 512 /* head partition size without latency */
+#define CONVOLVER_MIN_SIZE 32 /* smallest head partition with latency */
+#define CONVOLVER_MAX_SIZE 16384 /* partition size the tail stops growing at */
+#define CONVOLVER_MAX_SEGMENTS 16
+#define CONVOLVER_MAX_THREADS 64
+#define CONVOLVER_THREAD_MIN 8192 /* partitioned samples worth splitting across threads */
+
+/* A segment's view of the impulse partitions of one set, in either precision.
+ * Nothing is in use where used is NULL. */
+
+typedef struct convolver_ir {
+	const convolver_spectrum *f; /* impulse partitions in frequency domain, unless stored in half */
+	const convolver_half_spectrum *h; /* the same, in half precision, if stored that way */
+	const int *used; /* partitions in use, up to the last that isn't silent, per impulse channel */
+} convolver_ir;
+
+typedef struct convolver_segment {
+	int fftlen; /* size of FFT, twice the partition size */
+	int fftlenover2; /* half size of FFT */
 	int fftlenlog2; /* log2 of FFT size */
-#endif
-	int stepsize; /* size of overlapping steps */
+	int stepsize; /* size of overlapping steps, and of each impulse partition */
+	int offset; /* where the first partition starts in the impulse */
+	int partitions; /* impulse partitions, and depth of the input delay line */
+	int current; /* delay line slot of the block being filled */
 	int buffered_in; /* how many input samples buffered */
-	int buffered_out; /* output samples buffered */
+	convolver_plan *plan; /* transforms, shared with the rest of the process */
+	convolver_spectrum *f_in; /* input delay line in frequency domain, per input */
+	convolver_ir ir; /* impulse partitions, from the impulse set */
+	convolver_spectrum *f_acc; /* older partitions summed in frequency domain, per output */
+	convolver_ir ir_old; /* impulse partitions being faded out, until the next block */
+	convolver_spectrum *f_acc_old; /* the same sums, against those */
+	int fade_write; /* the zero latency head block being written fades */
+	char *silent; /* whether each block in the delay line is silence, per input */
+	char *acc_silent; /* whether each of f_acc, then f_acc_old, sums to nothing */
+	float **inspace; /* input work space */
+} convolver_segment;
+
+/* The transformed impulses are kept apart from the rest of the state, so any
+ * number of instances with the same layout can share them read-only. Each
+ * instance holds a reference, and the last one released frees them. The set
+ * is only written to while a single instance holds it. */
+
+typedef struct convolver_impulses {
+	convolver_arena arena; /* the block holding all of the set, this included */
+	int refs; /* references, updated atomically */
+	int borrowed; /* spectra belong to the caller, and are never written */
+	int half; /* spectra are stored in half precision */
+	int impulselen; /* size of impulse */
+	int latency; /* output delay, zero or the head partition size */
+	int head; /* head partition size */
+	int inputs; /* Input channels */
+	int outputs; /* Output channels */
+	int mode; /* Mode */
+	int segment_count; /* segments in use */
+	int fftlen[CONVOLVER_MAX_SEGMENTS]; /* size of FFT, per segment */
+	int partitions[CONVOLVER_MAX_SEGMENTS]; /* impulse partitions, per segment */
+	convolver_plan *plan[CONVOLVER_MAX_SEGMENTS]; /* transforms the spectra came from, per segment */
+	convolver_spectrum *f_ir[CONVOLVER_MAX_SEGMENTS]; /* impulse partitions in frequency domain, per segment */
+	convolver_half_spectrum *h_ir[CONVOLVER_MAX_SEGMENTS]; /* the same, in half precision, instead */
+	int *used[CONVOLVER_MAX_SEGMENTS]; /* partitions up to the last that isn't silent, per impulse channel, per segment */
+} convolver_impulses;
+
+/* Everything a thread needs of its own to run part of a block. The calling
+ * thread is always the first worker, and any others wait in the pool. */
+
+typedef struct convolver_worker {
+	struct convolver_state *state;
+	pthread_t thread;
+	convolver_spectrum f_out[CONVOLVER_MAX_BATCH]; /* output in frequency domain, for a batch of outputs */
+	float *revspace[CONVOLVER_MAX_BATCH]; /* reverse work space */
+	convolver_spectrum f_fade[CONVOLVER_MAX_BATCH]; /* output being faded out, in frequency domain */
+	float *fadespace[CONVOLVER_MAX_BATCH]; /* the same, in time domain */
+	kiss_fft_cpx *f_work; /* interleaved spectrum, to and from the planes, with kissfft */
+	kiss_fft_cpx *f_temp; /* work space for the transforms */
+	kiss_fft_cpx *f_pack, *f_packed; /* two channels packed into one, in both domains */
+#ifdef CONVOLVER_KISS4
+	__m128 *f_lanes; /* four channels, one per lane, in time domain */
+	kiss_fft4_cpx *f_work4, *f_temp4; /* the same as above, four channels at once */
+#endif
+} convolver_worker;
+
+typedef void (*convolver_task)(struct convolver_state *, convolver_worker *, int);
+
+typedef struct convolver_state {
+	convolver_arena arena; /* the block holding all of the instance, this included */
+	int huge; /* blocks are backed by huge pages, where the system has them */
+	int impulselen; /* size of impulse */
+	int latency; /* output delay, zero or the head partition size */
 	int inputs; /* Input channels */
 	int outputs; /* Output channels */
 	int mode; /* Mode */
+	int paths; /* input to output paths, one per impulse channel used */
+	int trim_fade; /* fade out at the end of each impulse, when trimmed */
+	int *sizes; /* size of each impulse, when they differ */
+	int half; /* impulse sets staged here store their spectra in half precision */
+
+	/* Inputs with nothing but low frequencies can be run at a reduced rate,
+	 * through a convolver of their own, between a decimator and an
+	 * interpolator, which share one filter. */
+
+	int low_factor; /* rate reduction */
+	int low_latency; /* latency of their convolver, at the reduced rate */
+	int low_head; /* impulse taps ahead of where they line up, run at full rate */
+	int low_count; /* inputs run at the reduced rate */
+	int *low_inputs; /* which ones */
+	char *lowpass; /* per input, whether it is one of them */
+	float *low_filter; /* polyphase filter, CONVOLVER_LOW_TAPS per phase */
+	float *low_reverse; /* the same, back to front, for the decimator */
+	float *low_phases; /* the same, one phase after another, for the interpolator */
+	float *low_hist; /* decimator history, per reduced input, written twice over */
+	int low_pos; /* newest sample in the decimator history */
+	float *low_out; /* interpolator history, per output, newest first */
+	int low_phase; /* full rate samples since the last reduced one */
+	float *low_y, *low_z; /* reduced rate input and output, per chunk */
+	void *low; /* the convolver running at the reduced rate */
+	float silence; /* largest sample in a block taken as silence */
+
+	/* With a direct head, the first taps of each impulse are convolved one
+	 * sample at a time, without latency, and the segments run the rest of
+	 * it with a latency of as many samples, so it lines up after them. */
+
+	int direct; /* taps run directly, and the latency of the segments */
+	float *direct_h; /* those taps, per impulse channel */
+	char *direct_live; /* whether each of them has any that aren't zero */
+	float **direct_in; /* input history, followed by the chunk being run, per input */
+	float *direct_out; /* output of the chunk being run */
+	int segment_count; /* segments in use */
+	int outlen; /* size of output work space */
+	int outpos; /* start of the current head block in the output work space */
+	convolver_segment segments[CONVOLVER_MAX_SEGMENTS];
+	convolver_impulses *impulses; /* impulse set, possibly shared */
+	float **outspace; /* output work space */
+	int workers; /* workers, counting the calling thread */
+	convolver_worker *worker;
+	convolver_spectrum *f_part; /* sum of each path, when split across workers */
+	convolver_spectrum *f_part_old; /* the same, against the set being faded out */
+	char *part_live; /* whether each of f_part, then f_part_old, summed anything */
+
+	/* A new impulse set is handed over through pending, and picked up at
+	 * the start of a head block. Until each segment has faded over one
+	 * block of its own, the old set is kept in fading. */
+
+	convolver_impulses *pending;
+	convolver_impulses *fading;
+	int fading_segments; /* segments yet to fade */
+
+	/* The pool runs one batch of tasks at a time, numbered from zero, on a
+	 * single segment. Each new batch bumps the generation, which wakes the
+	 * pool, and whoever is free takes the next task. */
+
+	int started; /* pool threads running */
+	int pool_ready; /* lock and conditions are initialized */
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+	unsigned int generation;
+	int quit;
+	convolver_task task;
+	convolver_segment *task_seg;
+	int task_count, task_next, task_done;
+} convolver_state;
+
+/* Paths are numbered the same as the impulse channels feeding them in mode 2,
+ * and one per input channel otherwise. Each output sums all of its paths in
+ * the frequency domain, so it needs only one inverse transform. */
+
+static inline int _path_input(const convolver_state *state, int path) {
+	return state->mode == 2 ? path / state->outputs : path;
+}
+
+static inline int _path_impulse(const convolver_state *state, int path) {
+	return state->mode == 0 ? 0 : path;
+}
+
+static inline int _output_paths(const convolver_state *state) {
+	return state->mode == 2 ? state->inputs : 1;
+}
+
+static inline int _output_path(const convolver_state *state, int output, int n) {
+	return state->mode == 2 ? n * state->outputs + output : output;
+}
+
+static inline int _input_paths(const convolver_state *state) {
+	return state->mode == 2 ? state->outputs : 1;
+}
+
+static inline int _input_path(const convolver_state *state, int input, int n) {
+	return state->mode == 2 ? input * state->outputs + n : input;
+}
+
+static int _channels_for(int mode, int inputs, int outputs) {
+	if(mode == 0)
+		return 1;
+	else if(mode == 1)
+		return inputs;
+	else
+		return inputs * outputs;
+}
+
+static int _total_channels(const convolver_state *state) {
+	return _channels_for(state->mode, state->inputs, state->outputs);
+}
+
+/* Drops the references segments hold on their plans, as far as picked. */
+
+static void _segments_drop(convolver_segment *segments, int count) {
+	int i;
+	for(i = 0; i < count; ++i)
+		_plan_drop(segments[i].plan);
+}
+
+/* Only the first length samples of the input count, and the rest are taken
+ * as zeros. kissfft never reads them, and skips the work they would take in
+ * its first stage, as do the built in transforms, while FFTW and vDSP need
+ * them zeroed. */
+
+static void _fft_forward(convolver_segment *seg, convolver_worker *worker, float *in, int length, convolver_spectrum out) {
+	const convolver_plan *plan = seg->plan;
+
+	switch(plan->fft) {
+	case CONVOLVER_FFT_KISS:
+	case CONVOLVER_FFT_KISS4: {
+		int k, count = seg->fftlenover2;
+		kiss_fft_cpx *work = worker->f_work;
+
+		kiss_fftr_pruned_work(plan->kiss_fw, plan->kiss_qfw, in, length, work, worker->f_temp);
+
+		for(k = 0; k < count; ++k) {
+			out.realp[k] = work[k].r;
+			out.imagp[k] = work[k].i;
+		}
+		out.imagp[0] = work[count].r;
+		break;
+	}
+	case CONVOLVER_FFT_SPLIT:
+		splitfft_forward(plan->split, in, length, out.realp, out.imagp);
+		break;
+#ifdef USE_FFTW
+	case CONVOLVER_FFT_FFTW:
+		fftwf_execute_split_dft_r2c(plan->fw, in, out.realp, out.imagp);
+		out.imagp[0] = out.realp[seg->fftlenover2];
+		break;
+#endif
+#ifdef CONVOLVER_VDSP
+	case CONVOLVER_FFT_VDSP:
+		vDSP_ctoz((DSPComplex *)in, 2, &out, 1, seg->fftlenover2);
+		vDSP_fft_zrip(plan->setup, &out, 1, seg->fftlenlog2, FFT_FORWARD);
+		break;
+#endif
+	}
+}
+
+/* The input spectrum is destroyed by some libraries, so only scratch space
+ * should be passed here. */
+
+static void _fft_inverse(convolver_segment *seg, convolver_worker *worker, convolver_spectrum in, float *out) {
+	const convolver_plan *plan = seg->plan;
+
+	switch(plan->fft) {
+	case CONVOLVER_FFT_KISS:
+	case CONVOLVER_FFT_KISS4: {
+		int k, count = seg->fftlenover2;
+		kiss_fft_cpx *work = worker->f_work;
+
+		for(k = 0; k < count; ++k) {
+			work[k].r = in.realp[k];
+			work[k].i = in.imagp[k];
+		}
+		work[0].i = 0;
+		work[count].r = in.imagp[0];
+		work[count].i = 0;
+
+		kiss_fftri_work(plan->kiss_bw, work, out, worker->f_temp);
+		break;
+	}
+	case CONVOLVER_FFT_SPLIT:
+		splitfft_inverse(plan->split, in.realp, in.imagp, out);
+		break;
 #ifdef USE_FFTW
-	fftwf_plan *p_fw, p_bw; /* forward and backwards plans */
-	fftwf_complex *f_in, *f_out, **f_ir; /* input, output, and impulse in frequency domain */
-#elif defined(__APPLE__)
-	FFTSetup setup; /* setup */
-	DSPSplitComplex f_in, f_out, *f_ir; /* input, output, and impulse in frequency domain */
+	case CONVOLVER_FFT_FFTW: {
+		int count = seg->fftlenover2;
+
+		in.realp[count] = in.imagp[0];
+		in.imagp[count] = 0;
+		in.imagp[0] = 0;
+
+		fftwf_execute_split_dft_c2r(plan->bw, in.realp, in.imagp, out);
+		break;
+	}
+#endif
+#ifdef CONVOLVER_VDSP
+	case CONVOLVER_FFT_VDSP:
+		vDSP_fft_zrip(plan->setup, &in, 1, seg->fftlenlog2, FFT_INVERSE);
+		vDSP_ztoc(&in, 1, (DSPComplex *)out, 2, seg->fftlenover2);
+		break;
+#endif
+	}
+}
+
+/* Two channels at once. With kissfft, one goes in as the real part and the
+ * other as the imaginary part of a single complex transform, and they are
+ * told apart by symmetry, as each real spectrum is its own conjugate mirror.
+ * The other libraries just run one after the other. */
+
+static void _fft_forward2(convolver_segment *seg, convolver_worker *worker, float *in1, float *in2, int length, convolver_spectrum out1, convolver_spectrum out2) {
+	int k, fftlen = seg->fftlen, count = seg->fftlenover2;
+	kiss_fft_cpx *pack = worker->f_pack, *packed = worker->f_packed;
+
+	if(seg->plan->fft != CONVOLVER_FFT_KISS) {
+		_fft_forward(seg, worker, in1, length, out1);
+		_fft_forward(seg, worker, in2, length, out2);
+		return;
+	}
+
+	/* Pruning the complex transform costs more than it saves, as the bins
+	 * come out of it shuffled, so this pads as it packs instead. */
+
+	for(k = 0; k < length; ++k) {
+		pack[k].r = in1[k];
+		pack[k].i = in2[k];
+	}
+	for(; k < fftlen; ++k)
+		pack[k].r = pack[k].i = 0;
+
+	kiss_fft(seg->plan->kiss_cfw, pack, packed);
+
+	out1.realp[0] = packed[0].r;
+	out1.imagp[0] = packed[count].r;
+	out2.realp[0] = packed[0].i;
+	out2.imagp[0] = packed[count].i;
+
+	for(k = 1; k < count; ++k) {
+		kiss_fft_cpx a = packed[k], b = packed[fftlen - k];
+		out1.realp[k] = (a.r + b.r) * 0.5f;
+		out1.imagp[k] = (a.i - b.i) * 0.5f;
+		out2.realp[k] = (a.i + b.i) * 0.5f;
+		out2.imagp[k] = (b.r - a.r) * 0.5f;
+	}
+}
+
+/* The inverse the other way around, where the second spectrum is turned a
+ * quarter, so it comes out as the imaginary part. */
+
+static void _fft_inverse2(convolver_segment *seg, convolver_worker *worker, convolver_spectrum in1, convolver_spectrum in2, float *out1, float *out2) {
+	int k, fftlen = seg->fftlen, count = seg->fftlenover2;
+	kiss_fft_cpx *pack = worker->f_pack, *packed = worker->f_packed;
+
+	if(seg->plan->fft != CONVOLVER_FFT_KISS) {
+		_fft_inverse(seg, worker, in1, out1);
+		_fft_inverse(seg, worker, in2, out2);
+		return;
+	}
+
+	pack[0].r = in1.realp[0];
+	pack[0].i = in2.realp[0];
+	pack[count].r = in1.imagp[0];
+	pack[count].i = in2.imagp[0];
+
+	for(k = 1; k < count; ++k) {
+		pack[k].r = in1.realp[k] - in2.imagp[k];
+		pack[k].i = in1.imagp[k] + in2.realp[k];
+		pack[fftlen - k].r = in1.realp[k] + in2.imagp[k];
+		pack[fftlen - k].i = in2.realp[k] - in1.imagp[k];
+	}
+
+	kiss_fft(seg->plan->kiss_cbw, pack, packed);
+
+	for(k = 0; k < fftlen; ++k) {
+		out1[k] = packed[k].r;
+		out2[k] = packed[k].i;
+	}
+}
+
+#ifdef CONVOLVER_KISS4
+/* Up to four channels at once, with kissfft built for SSE, which runs one
+ * transform in each lane. The samples and bins are turned across the lanes
+ * four at a time, and lanes without a channel are left zero. */
+
+static void _fft_forward4(convolver_segment *seg, convolver_worker *worker, float *const *in, int length, convolver_spectrum *out, int n) {
+	int j, k, count = seg->fftlenover2;
+	__m128 *lanes = worker->f_lanes;
+	kiss_fft4_cpx *work = worker->f_work4;
+	float nyquist[4];
+
+	for(k = 0; k + 4 <= length; k += 4) {
+		__m128 t[4];
+		for(j = 0; j < 4; ++j)
+			t[j] = j < n ? _mm_loadu_ps(in[j] + k) : _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(t[0], t[1], t[2], t[3]);
+		for(j = 0; j < 4; ++j)
+			lanes[k + j] = t[j];
+	}
+	for(; k < length; ++k) {
+		float t[4] = { 0, 0, 0, 0 };
+		for(j = 0; j < n; ++j)
+			t[j] = in[j][k];
+		lanes[k] = _mm_loadu_ps(t);
+	}
+
+	kiss_fftr4_pruned_work(seg->plan->kiss4_fw, seg->plan->kiss4_qfw, lanes, length, work, worker->f_temp4);
+
+	for(k = 0; k < count; k += 4) {
+		__m128 r[4], i[4];
+		for(j = 0; j < 4; ++j) {
+			r[j] = work[k + j].r;
+			i[j] = work[k + j].i;
+		}
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		_MM_TRANSPOSE4_PS(i[0], i[1], i[2], i[3]);
+		for(j = 0; j < n; ++j) {
+			_mm_storeu_ps(out[j].realp + k, r[j]);
+			_mm_storeu_ps(out[j].imagp + k, i[j]);
+		}
+	}
+
+	_mm_storeu_ps(nyquist, work[count].r);
+	for(j = 0; j < n; ++j)
+		out[j].imagp[0] = nyquist[j];
+}
+
+static void _fft_inverse4(convolver_segment *seg, convolver_worker *worker, convolver_spectrum *in, float **out, int n) {
+	int j, k, fftlen = seg->fftlen, count = seg->fftlenover2;
+	__m128 *lanes = worker->f_lanes;
+	kiss_fft4_cpx *work = worker->f_work4;
+	float nyquist[4] = { 0, 0, 0, 0 };
+
+	for(k = 0; k < count; k += 4) {
+		__m128 r[4], i[4];
+		for(j = 0; j < 4; ++j) {
+			r[j] = j < n ? _mm_loadu_ps(in[j].realp + k) : _mm_setzero_ps();
+			i[j] = j < n ? _mm_loadu_ps(in[j].imagp + k) : _mm_setzero_ps();
+		}
+		_MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+		_MM_TRANSPOSE4_PS(i[0], i[1], i[2], i[3]);
+		for(j = 0; j < 4; ++j) {
+			work[k + j].r = r[j];
+			work[k + j].i = i[j];
+		}
+	}
+
+	for(j = 0; j < n; ++j)
+		nyquist[j] = in[j].imagp[0];
+	work[0].i = _mm_setzero_ps();
+	work[count].r = _mm_loadu_ps(nyquist);
+	work[count].i = _mm_setzero_ps();
+
+	kiss_fftri4_work(seg->plan->kiss4_bw, work, lanes, worker->f_temp4);
+
+	for(k = 0; k < fftlen; k += 4) {
+		__m128 t[4];
+		for(j = 0; j < 4; ++j)
+			t[j] = lanes[k + j];
+		_MM_TRANSPOSE4_PS(t[0], t[1], t[2], t[3]);
+		for(j = 0; j < n; ++j)
+			_mm_storeu_ps(out[j] + k, t[j]);
+	}
+}
+#endif
+
+/* How many channels the library transforms at once, and a batch of up to
+ * that many, which may be one. */
+
+static int _fft_batch(const convolver_segment *seg) {
+	return _ffts[seg->plan->fft].batch;
+}
+
+static void _fft_forward_batch(convolver_segment *seg, convolver_worker *worker, float *const *in, int length, convolver_spectrum *out, int n) {
+	if(n == 1)
+		_fft_forward(seg, worker, in[0], length, out[0]);
+#ifdef CONVOLVER_KISS4
+	else if(seg->plan->fft == CONVOLVER_FFT_KISS4)
+		_fft_forward4(seg, worker, in, length, out, n);
+#endif
+	else
+		_fft_forward2(seg, worker, in[0], in[1], length, out[0], out[1]);
+}
+
+static void _fft_inverse_batch(convolver_segment *seg, convolver_worker *worker, convolver_spectrum *in, float **out, int n) {
+	if(n == 1)
+		_fft_inverse(seg, worker, in[0], out[0]);
+#ifdef CONVOLVER_KISS4
+	else if(seg->plan->fft == CONVOLVER_FFT_KISS4)
+		_fft_inverse4(seg, worker, in, out, n);
+#endif
+	else
+		_fft_inverse2(seg, worker, in[0], in[1], out[0], out[1]);
+}
+
+/* Left to pick for itself, each size is timed with every library built in
+ * that gives the format asked for, if any, on a forward and an inverse
+ * transform of half as much input, as the segments run them. The fastest is
+ * kept for the rest of the process. Called with the lock held. */
+
+#define CONVOLVER_TIME_SAMPLES (1 << 17) /* transformed per library and size, each round */
+#define CONVOLVER_TIME_ROUNDS 3
+
+static double _fft_clock(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Work space for kissfft, up to the given size, and for its SSE build as
+ * well, with kiss4, which runs single channels through the plain one. */
+
+static void _fft_kiss_carve(convolver_worker *worker, int fftlen, int fftlen4, convolver_arena *arena) {
+	worker->f_work = (kiss_fft_cpx *)_arena_take(arena, sizeof(kiss_fft_cpx) * (fftlen / 2 + 1));
+	worker->f_temp = (kiss_fft_cpx *)_arena_take(arena, sizeof(kiss_fft_cpx) * fftlen);
+	worker->f_pack = (kiss_fft_cpx *)_arena_take(arena, sizeof(kiss_fft_cpx) * fftlen);
+	worker->f_packed = (kiss_fft_cpx *)_arena_take(arena, sizeof(kiss_fft_cpx) * fftlen);
+#ifdef CONVOLVER_KISS4
+	if(fftlen4) {
+		worker->f_lanes = (__m128 *)_arena_take(arena, sizeof(__m128) * fftlen4);
+		worker->f_work4 = (kiss_fft4_cpx *)_arena_take(arena, sizeof(kiss_fft4_cpx) * (fftlen4 / 2 + 1));
+		worker->f_temp4 = (kiss_fft4_cpx *)_arena_take(arena, sizeof(kiss_fft4_cpx) * fftlen4);
+	}
 #else
-	kiss_fftr_cfg cfg_fw, cfg_bw; /* forward and backwards instances */
-	kiss_fft_cpx *f_in, *f_out, **f_ir; /* input, output, and impulse in frequency domain */
+	(void)fftlen4;
 #endif
-	float *revspace, **outspace, **inspace; /* reverse, output, and input work space */
-} convolver_state;
+}
+
+static void _fft_time_carve(convolver_segment *seg, convolver_worker *worker, float **in, convolver_arena *arena) {
+	int j;
+
+	*in = _arena_floats(arena, seg->fftlen);
+	for(j = 0; j < _fft_batch(seg); ++j) {
+		_arena_spectrum(arena, &worker->f_out[j], seg->fftlen);
+		worker->revspace[j] = _arena_floats(arena, seg->fftlen);
+	}
+	if(seg->plan->fft == CONVOLVER_FFT_KISS || seg->plan->fft == CONVOLVER_FFT_KISS4)
+		_fft_kiss_carve(worker, seg->fftlen, seg->plan->fft == CONVOLVER_FFT_KISS4 ? seg->fftlen : 0, arena);
+}
+
+static double _fft_time(convolver_plan *plan) {
+	convolver_arena arena = { NULL, 0, 0 };
+	convolver_segment seg;
+	convolver_worker worker;
+	float *in, *ins[CONVOLVER_MAX_BATCH];
+	double best = -1.0;
+	int reps, round, i, batch;
+
+	memset(&seg, 0, sizeof(seg));
+	memset(&worker, 0, sizeof(worker));
+	seg.fftlenlog2 = plan->fftlenlog2;
+	seg.fftlen = 1 << seg.fftlenlog2;
+	seg.fftlenover2 = seg.fftlen / 2;
+	seg.plan = plan;
+
+	_fft_time_carve(&seg, &worker, &in, &arena);
+	if(_arena_open(&arena, 0) < 0)
+		return -1.0;
+	_fft_time_carve(&seg, &worker, &in, &arena);
+
+	for(i = 0; i < seg.fftlen; ++i)
+		in[i] = i < seg.fftlenover2 ? (float)(i % 17) / 8.0f - 1.0f : 0.0f;
+
+	/* Libraries that transform more than one channel at once are timed
+	 * with as many as they take, per channel. */
+
+	batch = _fft_batch(&seg);
+	for(i = 0; i < batch; ++i)
+		ins[i] = in;
+
+	reps = CONVOLVER_TIME_SAMPLES >> seg.fftlenlog2;
+	if(reps < 4)
+		reps = 4;
+
+	for(round = 0; round < CONVOLVER_TIME_ROUNDS; ++round) {
+		double start = _fft_clock(), elapsed;
+		for(i = 0; i < reps; ++i) {
+			_fft_forward_batch(&seg, &worker, ins, seg.fftlenover2, worker.f_out, batch);
+			_fft_inverse_batch(&seg, &worker, worker.f_out, worker.revspace, batch);
+		}
+		elapsed = _fft_clock() - start;
+		if(best < 0.0 || elapsed < best)
+			best = elapsed;
+	}
+
+	_arena_close(arena);
+	return best / batch;
+}
+
+/* A plan for the given size, from the library set by the caller, unless it
+ * can't give the format asked for, or else the fastest that can. With a
+ * format of zero, any will do. The caller gets a reference on it. */
+
+static convolver_plan *_plan_pick(int fftlenlog2, int format) {
+	convolver_plan *plan = NULL;
+	int fft;
+
+	pthread_mutex_lock(&_plan_lock);
+	_fft_choose();
+
+	fft = _fft_choice;
+	if(fft != CONVOLVER_FFT_AUTO && format && _ffts[fft].format != format)
+		fft = CONVOLVER_FFT_AUTO;
+
+	if(fft == CONVOLVER_FFT_AUTO && (fft = _fft_best[format][fftlenlog2]) == 0) {
+		double best = 0.0;
+		int i;
+
+		for(i = 1; i < CONVOLVER_FFT_COUNT; ++i) {
+			convolver_plan *candidate;
+			double elapsed;
+
+			if(!_fft_available(i) || (format && _ffts[i].format != format))
+				continue;
+			if((candidate = _plan_get(i, fftlenlog2)) == NULL)
+				continue;
+			if((elapsed = _fft_time(candidate)) < 0.0)
+				continue;
+			if(!fft || elapsed < best) {
+				fft = i;
+				best = elapsed;
+			}
+		}
+
+		_fft_best[format][fftlenlog2] = fft;
+	}
+
+	if(fft && (plan = _plan_get(fft, fftlenlog2)) != NULL)
+		_plan_hold(plan);
+	pthread_mutex_unlock(&_plan_lock);
+
+	return plan;
+}
+
+static void _spectrum_clear(convolver_segment *seg, convolver_spectrum out) {
+	memset(out.realp, 0, sizeof(float) * seg->fftlenover2);
+	memset(out.imagp, 0, sizeof(float) * seg->fftlenover2);
+}
+
+/* IEEE half precision, converted by hand, so it works everywhere. Rounding is
+ * to nearest even, and anything too large is clamped, though the spectra are
+ * scaled to never get there. */
+
+static float _half_to_float(unsigned short h) {
+	unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+	unsigned int exponent = (h >> 10) & 0x1f;
+	unsigned int mantissa = h & 0x3ff;
+	unsigned int bits;
+	float f;
+
+	if(exponent == 0) {
+		f = ldexpf((float)mantissa, -24);
+		return sign ? -f : f;
+	} else if(exponent == 31)
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	else
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static unsigned short _float_to_half(float f) {
+	unsigned int bits, sign, mantissa, half;
+	int exponent, shift;
+
+	memcpy(&bits, &f, sizeof(bits));
+	sign = (bits >> 16) & 0x8000;
+	exponent = (int)((bits >> 23) & 0xff) - 112;
+	mantissa = bits & 0x7fffff;
+
+	if(exponent >= 31)
+		return (unsigned short)(sign | 0x7bff);
+
+	if(exponent <= 0) {
+		if(exponent < -10)
+			return (unsigned short)sign;
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+	} else {
+		mantissa |= (unsigned int)exponent << 23;
+		shift = 13;
+	}
+
+	half = mantissa >> shift;
+	if((mantissa >> (shift - 1)) & 1) {
+		if((mantissa & ((1u << (shift - 1)) - 1)) || (half & 1))
+			++half;
+	}
+	if(half > 0x7bff)
+		half = 0x7bff;
+
+	return (unsigned short)(sign | half);
+}
+
+/* Products against a half spectrum, in the same way as the ones below. */
+
+static void _half_mac_c(convolver_spectrum out, convolver_spectrum a, const convolver_half_spectrum *b, const convolver_spectrum *add, int k, int count) {
+	float scale = b->scale;
+	for(; k < count; ++k) {
+		float br = _half_to_float(b->realp[k]) * scale;
+		float bi = _half_to_float(b->imagp[k]) * scale;
+		float re = a.realp[k] * br - a.imagp[k] * bi;
+		float im = a.realp[k] * bi + a.imagp[k] * br;
+		if(add) {
+			re += add->realp[k];
+			im += add->imagp[k];
+		}
+		out.realp[k] = re;
+		out.imagp[k] = im;
+	}
+}
+
+/* Direct convolution of a run of samples, added to the output. The input has
+ * as many samples of history before the first as there are taps, less one. */
+
+static void _direct_fir_c(float *out, const float *in, const float *h, int taps, int n, int count) {
+	int k;
+	for(; n < count; ++n) {
+		float sum = 0.0f;
+		for(k = 0; k < taps; ++k)
+			sum += h[k] * in[n - k];
+		out[n] += sum;
+	}
+}
+
+#ifdef CONVOLVER_X86_KERNELS
+/* Complex products of each bin, added to another spectrum if there is one,
+ * which may also be the output. These treat every bin alike, so the packed
+ * DC and Nyquist bins are fixed up afterwards. */
+
+static void _spectrum_mac_c(convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, const convolver_spectrum *add, int k, int count) {
+	for(; k < count; ++k) {
+		float re = a.realp[k] * b.realp[k] - a.imagp[k] * b.imagp[k];
+		float im = a.realp[k] * b.imagp[k] + a.imagp[k] * b.realp[k];
+		if(add) {
+			re += add->realp[k];
+			im += add->imagp[k];
+		}
+		out.realp[k] = re;
+		out.imagp[k] = im;
+	}
+}
+
+static void _spectrum_mac_scalar(convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, const convolver_spectrum *add, int count) {
+	_spectrum_mac_c(out, a, b, add, 0, count);
+}
+
+__attribute__((target("sse2")))
+static void _spectrum_mac_sse2(convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, const convolver_spectrum *add, int count) {
+	int k;
+	for(k = 0; k + 4 <= count; k += 4) {
+		__m128 ar = _mm_loadu_ps(a.realp + k), ai = _mm_loadu_ps(a.imagp + k);
+		__m128 br = _mm_loadu_ps(b.realp + k), bi = _mm_loadu_ps(b.imagp + k);
+		__m128 re = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+		__m128 im = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+		if(add) {
+			re = _mm_add_ps(re, _mm_loadu_ps(add->realp + k));
+			im = _mm_add_ps(im, _mm_loadu_ps(add->imagp + k));
+		}
+		_mm_storeu_ps(out.realp + k, re);
+		_mm_storeu_ps(out.imagp + k, im);
+	}
+	_spectrum_mac_c(out, a, b, add, k, count);
+}
+
+__attribute__((target("avx")))
+static void _spectrum_mac_avx(convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, const convolver_spectrum *add, int count) {
+	int k;
+	for(k = 0; k + 8 <= count; k += 8) {
+		__m256 ar = _mm256_loadu_ps(a.realp + k), ai = _mm256_loadu_ps(a.imagp + k);
+		__m256 br = _mm256_loadu_ps(b.realp + k), bi = _mm256_loadu_ps(b.imagp + k);
+		__m256 re = _mm256_sub_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi));
+		__m256 im = _mm256_add_ps(_mm256_mul_ps(ar, bi), _mm256_mul_ps(ai, br));
+		if(add) {
+			re = _mm256_add_ps(re, _mm256_loadu_ps(add->realp + k));
+			im = _mm256_add_ps(im, _mm256_loadu_ps(add->imagp + k));
+		}
+		_mm256_storeu_ps(out.realp + k, re);
+		_mm256_storeu_ps(out.imagp + k, im);
+	}
+	_spectrum_mac_c(out, a, b, add, k, count);
+}
+
+__attribute__((target("avx2,fma")))
+static void _spectrum_mac_fma(convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, const convolver_spectrum *add, int count) {
+	int k;
+	for(k = 0; k + 8 <= count; k += 8) {
+		__m256 ar = _mm256_loadu_ps(a.realp + k), ai = _mm256_loadu_ps(a.imagp + k);
+		__m256 br = _mm256_loadu_ps(b.realp + k), bi = _mm256_loadu_ps(b.imagp + k);
+		__m256 re = add ? _mm256_loadu_ps(add->realp + k) : _mm256_setzero_ps();
+		__m256 im = add ? _mm256_loadu_ps(add->imagp + k) : _mm256_setzero_ps();
+		re = _mm256_fnmadd_ps(ai, bi, _mm256_fmadd_ps(ar, br, re));
+		im = _mm256_fmadd_ps(ai, br, _mm256_fmadd_ps(ar, bi, im));
+		_mm256_storeu_ps(out.realp + k, re);
+		_mm256_storeu_ps(out.imagp + k, im);
+	}
+	_spectrum_mac_c(out, a, b, add, k, count);
+}
+
+__attribute__((target("avx512f")))
+static void _spectrum_mac_avx512(convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, const convolver_spectrum *add, int count) {
+	int k;
+	for(k = 0; k + 16 <= count; k += 16) {
+		__m512 ar = _mm512_loadu_ps(a.realp + k), ai = _mm512_loadu_ps(a.imagp + k);
+		__m512 br = _mm512_loadu_ps(b.realp + k), bi = _mm512_loadu_ps(b.imagp + k);
+		__m512 re = add ? _mm512_loadu_ps(add->realp + k) : _mm512_setzero_ps();
+		__m512 im = add ? _mm512_loadu_ps(add->imagp + k) : _mm512_setzero_ps();
+		re = _mm512_fnmadd_ps(ai, bi, _mm512_fmadd_ps(ar, br, re));
+		im = _mm512_fmadd_ps(ai, br, _mm512_fmadd_ps(ar, bi, im));
+		_mm512_storeu_ps(out.realp + k, re);
+		_mm512_storeu_ps(out.imagp + k, im);
+	}
+	_spectrum_mac_c(out, a, b, add, k, count);
+}
+
+static void _half_mac_scalar(convolver_spectrum out, convolver_spectrum a, const convolver_half_spectrum *b, const convolver_spectrum *add, int count) {
+	_half_mac_c(out, a, b, add, 0, count);
+}
+
+/* F16C converts eight halves at once, straight from the load. */
+
+__attribute__((target("avx2,fma,f16c")))
+static void _half_mac_f16c(convolver_spectrum out, convolver_spectrum a, const convolver_half_spectrum *b, const convolver_spectrum *add, int count) {
+	__m256 scale = _mm256_set1_ps(b->scale);
+	int k;
+	for(k = 0; k + 8 <= count; k += 8) {
+		__m256 ar = _mm256_loadu_ps(a.realp + k), ai = _mm256_loadu_ps(a.imagp + k);
+		__m256 br = _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b->realp + k))), scale);
+		__m256 bi = _mm256_mul_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(b->imagp + k))), scale);
+		__m256 re = add ? _mm256_loadu_ps(add->realp + k) : _mm256_setzero_ps();
+		__m256 im = add ? _mm256_loadu_ps(add->imagp + k) : _mm256_setzero_ps();
+		re = _mm256_fnmadd_ps(ai, bi, _mm256_fmadd_ps(ar, br, re));
+		im = _mm256_fmadd_ps(ai, br, _mm256_fmadd_ps(ar, bi, im));
+		_mm256_storeu_ps(out.realp + k, re);
+		_mm256_storeu_ps(out.imagp + k, im);
+	}
+	_half_mac_c(out, a, b, add, k, count);
+}
+
+/* The vector ones run a sample per lane, with two sums, for the even and odd
+ * taps, which there always are as many of. */
+
+static void _direct_fir_scalar(float *out, const float *in, const float *h, int taps, int count) {
+	_direct_fir_c(out, in, h, taps, 0, count);
+}
+
+__attribute__((target("sse2")))
+static void _direct_fir_sse2(float *out, const float *in, const float *h, int taps, int count) {
+	int n, k;
+	for(n = 0; n + 4 <= count; n += 4) {
+		__m128 even = _mm_setzero_ps(), odd = _mm_setzero_ps();
+		for(k = 0; k < taps; k += 2) {
+			even = _mm_add_ps(even, _mm_mul_ps(_mm_set1_ps(h[k]), _mm_loadu_ps(in + n - k)));
+			odd = _mm_add_ps(odd, _mm_mul_ps(_mm_set1_ps(h[k + 1]), _mm_loadu_ps(in + n - k - 1)));
+		}
+		_mm_storeu_ps(out + n, _mm_add_ps(_mm_loadu_ps(out + n), _mm_add_ps(even, odd)));
+	}
+	_direct_fir_c(out, in, h, taps, n, count);
+}
+
+__attribute__((target("avx2,fma")))
+static void _direct_fir_fma(float *out, const float *in, const float *h, int taps, int count) {
+	int n, k;
+	for(n = 0; n + 8 <= count; n += 8) {
+		__m256 even = _mm256_setzero_ps(), odd = _mm256_setzero_ps();
+		for(k = 0; k < taps; k += 2) {
+			even = _mm256_fmadd_ps(_mm256_set1_ps(h[k]), _mm256_loadu_ps(in + n - k), even);
+			odd = _mm256_fmadd_ps(_mm256_set1_ps(h[k + 1]), _mm256_loadu_ps(in + n - k - 1), odd);
+		}
+		_mm256_storeu_ps(out + n, _mm256_add_ps(_mm256_loadu_ps(out + n), _mm256_add_ps(even, odd)));
+	}
+	_direct_fir_c(out, in, h, taps, n, count);
+}
+
+static void (*_spectrum_mac)(convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, const convolver_spectrum *add, int count) = _spectrum_mac_scalar;
+static void (*_half_mac)(convolver_spectrum out, convolver_spectrum a, const convolver_half_spectrum *b, const convolver_spectrum *add, int count) = _half_mac_scalar;
+static void (*_direct_fir)(float *out, const float *in, const float *h, int taps, int count) = _direct_fir_scalar;
+
+/* This only ever stores the same choice, so it doesn't matter which convolver
+ * gets here first. */
+
+static void _spectrum_mac_select(void) {
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		_spectrum_mac = _spectrum_mac_avx512;
+	else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		_spectrum_mac = _spectrum_mac_fma;
+	else if(__builtin_cpu_supports("avx"))
+		_spectrum_mac = _spectrum_mac_avx;
+	else if(__builtin_cpu_supports("sse2"))
+		_spectrum_mac = _spectrum_mac_sse2;
+	else
+		_spectrum_mac = _spectrum_mac_scalar;
+
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+		_half_mac = _half_mac_f16c;
+	else
+		_half_mac = _half_mac_scalar;
+
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		_direct_fir = _direct_fir_fma;
+	else if(__builtin_cpu_supports("sse2"))
+		_direct_fir = _direct_fir_sse2;
+	else
+		_direct_fir = _direct_fir_scalar;
+}
+#endif
+
+/* Cross multiply the products of the frequency domain, the real and imaginary
+ * values, into output real and imaginary pairs. The DC and Nyquist bins are
+ * both real, so they're multiplied on their own. */
+
+static void _spectrum_mul(convolver_segment *seg, convolver_spectrum out, convolver_spectrum a, convolver_spectrum b) {
+	int count = seg->fftlenover2;
+	float dc = a.realp[0] * b.realp[0];
+	float nyq = a.imagp[0] * b.imagp[0];
+#ifdef CONVOLVER_VDSP
+	vDSP_zvmul(&a, 1, &b, 1, &out, 1, count, 1);
+#elif defined(CONVOLVER_X86_KERNELS)
+	_spectrum_mac(out, a, b, NULL, count);
+#else
+	int k;
+	for(k = 0; k < count; ++k) {
+		float re = a.realp[k] * b.realp[k] - a.imagp[k] * b.imagp[k];
+		float im = a.realp[k] * b.imagp[k] + a.imagp[k] * b.realp[k];
+		out.realp[k] = re;
+		out.imagp[k] = im;
+	}
+#endif
+	out.realp[0] = dc;
+	out.imagp[0] = nyq;
+}
+
+/* The same, on top of another spectrum, which may also be the output. */
+
+static void _spectrum_muladd(convolver_segment *seg, convolver_spectrum out, convolver_spectrum a, convolver_spectrum b, convolver_spectrum add) {
+	int count = seg->fftlenover2;
+	float dc = add.realp[0] + a.realp[0] * b.realp[0];
+	float nyq = add.imagp[0] + a.imagp[0] * b.imagp[0];
+#ifdef CONVOLVER_VDSP
+	vDSP_zvma(&a, 1, &b, 1, &add, 1, &out, 1, count);
+#elif defined(CONVOLVER_X86_KERNELS)
+	_spectrum_mac(out, a, b, &add, count);
+#else
+	int k;
+	for(k = 0; k < count; ++k) {
+		float re = a.realp[k] * b.realp[k] - a.imagp[k] * b.imagp[k] + add.realp[k];
+		float im = a.realp[k] * b.imagp[k] + a.imagp[k] * b.realp[k] + add.imagp[k];
+		out.realp[k] = re;
+		out.imagp[k] = im;
+	}
+#endif
+	out.realp[0] = dc;
+	out.imagp[0] = nyq;
+}
+
+/* Either of those, against a half spectrum. */
+
+static void _half_muladd(convolver_segment *seg, convolver_spectrum out, convolver_spectrum a, const convolver_half_spectrum *b, const convolver_spectrum *add) {
+	int count = seg->fftlenover2;
+	float dc = a.realp[0] * _half_to_float(b->realp[0]) * b->scale;
+	float nyq = a.imagp[0] * _half_to_float(b->imagp[0]) * b->scale;
+	if(add) {
+		dc += add->realp[0];
+		nyq += add->imagp[0];
+	}
+#ifdef CONVOLVER_X86_KERNELS
+	_half_mac(out, a, b, add, count);
+#else
+	_half_mac_c(out, a, b, add, 0, count);
+#endif
+	out.realp[0] = dc;
+	out.imagp[0] = nyq;
+}
+
+/* And against one partition of an impulse, in whichever precision it has. */
+
+static void _ir_muladd(convolver_segment *seg, convolver_spectrum out, convolver_spectrum a, const convolver_ir *ir, int index, const convolver_spectrum *add) {
+	if(ir->h)
+		_half_muladd(seg, out, a, &ir->h[index], add);
+	else if(add)
+		_spectrum_muladd(seg, out, a, ir->f[index], *add);
+	else
+		_spectrum_mul(seg, out, a, ir->f[index]);
+}
+
+/* Spectra are stored in half precision scaled so the largest bin lands just
+ * under the top of the range, which leaves the rest of it for the smallest. */
+
+static void _half_store(convolver_segment *seg, convolver_half_spectrum *out, convolver_spectrum in) {
+	int k, exponent, count = seg->fftlenover2;
+	float largest = 0.0f, scale;
+
+	for(k = 0; k < count; ++k) {
+		if(fabsf(in.realp[k]) > largest)
+			largest = fabsf(in.realp[k]);
+		if(fabsf(in.imagp[k]) > largest)
+			largest = fabsf(in.imagp[k]);
+	}
+
+	frexpf(largest, &exponent);
+	exponent = largest > 0.0f ? 15 - exponent : 0;
+	scale = ldexpf(1.0f, exponent);
+	out->scale = ldexpf(1.0f, -exponent);
+
+	for(k = 0; k < count; ++k) {
+		out->realp[k] = _float_to_half(in.realp[k] * scale);
+		out->imagp[k] = _float_to_half(in.imagp[k] * scale);
+	}
+}
+
+static void _half_load(int bins, float *out, const convolver_half_spectrum *in) {
+	int k;
+	for(k = 0; k < bins; ++k) {
+		out[k] = _half_to_float(in->realp[k]) * in->scale;
+		out[bins + k] = _half_to_float(in->imagp[k]) * in->scale;
+	}
+}
+
+/* Spectra add up the same whether or not bins are packed. */
+
+static void _spectrum_add(convolver_segment *seg, convolver_spectrum out, convolver_spectrum a, convolver_spectrum b) {
+	int count = seg->fftlenover2;
+#ifdef CONVOLVER_VDSP
+	vDSP_zvadd(&a, 1, &b, 1, &out, 1, count);
+#else
+	int k;
+	for(k = 0; k < count; ++k) {
+		out.realp[k] = a.realp[k] + b.realp[k];
+		out.imagp[k] = a.imagp[k] + b.imagp[k];
+	}
+#endif
+}
+
+static void _spectrum_copy(convolver_segment *seg, convolver_spectrum out, convolver_spectrum in) {
+	memcpy(out.realp, in.realp, sizeof(float) * seg->fftlenover2);
+	memcpy(out.imagp, in.imagp, sizeof(float) * seg->fftlenover2);
+}
+
+static void _buffer_add(float *out, const float *in, int count) {
+#ifdef CONVOLVER_VDSP
+	vDSP_vadd(in, 1, out, 1, out, 1, count);
+#else
+	int k;
+	for(k = 0; k < count; ++k)
+		out[k] += in[k];
+#endif
+}
+
+/* Fade from one block of output to another, in place of the second one, as
+ * far into the fade as the block starts. */
+
+static void _buffer_fade(float *to, const float *from, int count, int start, int length) {
+	float scale = 1.0f / (float)length;
+	int k;
+	for(k = 0; k < count; ++k)
+		to[k] = from[k] + (to[k] - from[k]) * (float)(start + k) * scale;
+}
+
+/* Whether every sample is within the threshold of zero. Anything else,
+ * including NaN, is not silence. */
+
+static int _buffer_silent(const float *in, int count, float threshold) {
+	int k;
+	for(k = 0; k < count; ++k) {
+		if(!(fabsf(in[k]) <= threshold))
+			return 0;
+	}
+	return 1;
+}
+
+/* Rough cost of running a segment, per input sample, in units of one bin
+ * multiplied into a sum. A transform of N samples costs about half of
+ * N log2 N of those. */
+
+static double _segment_cost(const convolver_state *state, int size, int partitions) {
+	double transforms = state->inputs + state->outputs;
+	int log2n = 1;
+	while((1 << log2n) < size * 2)
+		++log2n;
+	return (transforms * size * log2n + (double)state->paths * partitions * (size + 1)) / size;
+}
+
+/* Lay out the segments, starting from the head partition size. Each segment
+ * either takes whatever remains of the impulse, or some partitions before
+ * the size doubles, as long as that leaves the next segment starting late
+ * enough. The cheapest layout is found by working back from the end of the
+ * impulse, in steps of one head partition. Taps run directly are left out. */
+
+#define CONVOLVER_MAX_STEPS 64 /* most partitions tried before doubling */
+
+static int _convolver_layout(convolver_state *state, int head) {
+	int length = state->impulselen > state->direct ? state->impulselen - state->direct : 1;
+	int units = (length + head - 1) / head;
+	int sizes, u, j, n, count, offset;
+	double *cost;
+	int *choice;
+
+	for(sizes = 1; (head << (sizes - 1)) < CONVOLVER_MAX_SIZE && sizes < CONVOLVER_MAX_SEGMENTS; ++sizes)
+		;
+
+	cost = (double *)malloc(sizeof(double) * (units + 1) * sizes);
+	choice = (int *)malloc(sizeof(int) * (units + 1) * sizes);
+	if(!cost || !choice) {
+		free(cost);
+		free(choice);
+		return -1;
+	}
+
+	for(u = units; u >= 0; --u) {
+		for(j = sizes - 1; j >= 0; --j) {
+			int size = head << j;
+			int step = 1 << j;
+			int remaining = (units - u + step - 1) / step;
+			double best;
+
+			if(u == units) {
+				cost[u * sizes + j] = 0;
+				choice[u * sizes + j] = 0;
+				continue;
+			}
+
+			best = _segment_cost(state, size, remaining);
+			choice[u * sizes + j] = remaining;
+
+			if(j + 1 < sizes) {
+				for(n = 1; n < remaining && n <= CONVOLVER_MAX_STEPS; ++n) {
+					int next = u + n * step;
+					double c;
+					if(next * head < (size * 2) - state->latency)
+						continue;
+					c = _segment_cost(state, size, n) + cost[next * sizes + j + 1];
+					if(c < best) {
+						best = c;
+						choice[u * sizes + j] = n;
+					}
+				}
+			}
+
+			cost[u * sizes + j] = best;
+		}
+	}
+
+	for(u = 0, j = 0, count = 0, offset = 0; u < units; ++j) {
+		convolver_segment *seg = &state->segments[count++];
+		int size = head << j;
+
+		n = choice[u * sizes + j];
+
+		seg->stepsize = size;
+		seg->offset = offset;
+		seg->partitions = n;
+		seg->fftlen = size * 2;
+		seg->fftlenover2 = size;
+		for(seg->fftlenlog2 = 0; (1 << seg->fftlenlog2) < seg->fftlen; ++seg->fftlenlog2)
+			;
+
+		offset += n * size;
+		u += n << j;
+	}
+
+	state->segment_count = count;
+
+	free(cost);
+	free(choice);
+	return 0;
+}
+
+static void _segment_carve(convolver_state *state, convolver_segment *seg, int head, convolver_arena *arena) {
+	int fftlen = seg->fftlen;
+	int partitions = seg->partitions;
+
+	seg->f_in = _arena_spectra(arena, state->inputs * partitions, fftlen);
+
+	if(head && !state->latency) {
+		seg->f_acc = _arena_spectra(arena, state->outputs, fftlen);
+		seg->f_acc_old = _arena_spectra(arena, state->outputs, fftlen);
+		seg->acc_silent = (char *)_arena_take(arena, state->outputs * 2);
+	}
+
+	seg->silent = (char *)_arena_take(arena, state->inputs * partitions);
+	seg->inspace = _arena_buffers(arena, state->inputs, fftlen);
+
+	/* The delay line starts out silent. */
+
+	if(arena->base) {
+		memset(seg->silent, 1, state->inputs * partitions);
+		if(seg->acc_silent)
+			memset(seg->acc_silent, 1, state->outputs * 2);
+	}
+}
+
+/* Each impulse channel only sums as many partitions of a segment as it takes
+ * to reach its last one that isn't silent, so shorter impulses cost less. A
+ * partition of silence transforms to exact zeros, which is what is checked
+ * for, so this works the same on spectra staged here or exported. */
+
+static int _spectrum_zero(convolver_spectrum in, int bins) {
+	int k;
+	for(k = 0; k < bins; ++k) {
+		if(in.realp[k] != 0.0f || in.imagp[k] != 0.0f)
+			return 0;
+	}
+	return 1;
+}
+
+static int _half_zero(const convolver_half_spectrum *in, int bins) {
+	int k;
+	for(k = 0; k < bins; ++k) {
+		if((in->realp[k] & 0x7fff) || (in->imagp[k] & 0x7fff))
+			return 0;
+	}
+	return 1;
+}
+
+static int _impulses_zero(const convolver_impulses *impulses, int s, int index) {
+	int bins = impulses->fftlen[s] / 2;
+	if(impulses->half)
+		return _half_zero(&impulses->h_ir[s][index], bins);
+	return _spectrum_zero(impulses->f_ir[s][index], bins);
+}
+
+static void _impulses_measure(convolver_impulses *impulses) {
+	int total_channels = _channels_for(impulses->mode, impulses->inputs, impulses->outputs);
+	int c, s;
+
+	for(s = 0; s < impulses->segment_count; ++s) {
+		int partitions = impulses->partitions[s];
+		for(c = 0; c < total_channels; ++c) {
+			int used = partitions;
+			while(used > 0 && _impulses_zero(impulses, s, c * partitions + used - 1))
+				--used;
+			impulses->used[s][c] = used;
+		}
+	}
+}
+
+/* A new impulse set, with room for the impulses as laid out for the state,
+ * and a single reference. The spectra are cleared, until staged, unless they
+ * are borrowed from exported spectra, which are used in place. Only sets
+ * staged here can be stored in half precision. */
+
+static convolver_impulses *_impulses_carve(const convolver_state *state, const float *spectra, convolver_arena *arena) {
+	convolver_impulses *ret = (convolver_impulses *)_arena_take(arena, sizeof(convolver_impulses));
+	convolver_impulses sizing, *impulses = ret ? ret : &sizing;
+	int total_channels = _total_channels(state);
+	int i, s;
+
+	impulses->refs = 1;
+	impulses->borrowed = spectra != NULL;
+	impulses->half = spectra == NULL && state->half;
+	impulses->impulselen = state->impulselen;
+	impulses->latency = state->latency;
+	impulses->head = state->segments[0].stepsize;
+	impulses->inputs = state->inputs;
+	impulses->outputs = state->outputs;
+	impulses->mode = state->mode;
+	impulses->segment_count = state->segment_count;
+
+	for(s = 0; s < state->segment_count; ++s) {
+		const convolver_segment *seg = &state->segments[s];
+		int count = total_channels * seg->partitions;
+
+		impulses->fftlen[s] = seg->fftlen;
+		impulses->partitions[s] = seg->partitions;
+		impulses->plan[s] = seg->plan;
+
+		impulses->used[s] = (int *)_arena_take(arena, sizeof(int) * total_channels);
+
+		if(impulses->half) {
+			impulses->h_ir[s] = _arena_half_spectra(arena, count, seg->fftlen);
+			continue;
+		}
+
+		if(!spectra) {
+			impulses->f_ir[s] = _arena_spectra(arena, count, seg->fftlen);
+			continue;
+		}
+
+		impulses->f_ir[s] = (convolver_spectrum *)_arena_take(arena, sizeof(convolver_spectrum) * count);
+		for(i = 0; i < count && impulses->f_ir[s]; ++i) {
+			impulses->f_ir[s][i].realp = (float *)spectra;
+			impulses->f_ir[s][i].imagp = (float *)spectra + seg->fftlenover2;
+			spectra += seg->fftlen;
+		}
+	}
+
+	return ret;
+}
+
+static convolver_impulses *_impulses_alloc(convolver_state *state, const float *spectra) {
+	convolver_arena arena = { NULL, 0, 0 };
+	convolver_impulses *impulses;
+	int s;
+
+	_impulses_carve(state, spectra, &arena);
+	if(_arena_open(&arena, state->huge) < 0)
+		return NULL;
+	impulses = _impulses_carve(state, spectra, &arena);
+	impulses->arena = arena;
+
+	for(s = 0; s < impulses->segment_count; ++s)
+		_plan_hold(impulses->plan[s]);
+
+	if(spectra)
+		_impulses_measure(impulses);
+
+	return impulses;
+}
+
+static void _impulses_view(convolver_ir *ir, const convolver_impulses *impulses, int s) {
+	ir->f = impulses->f_ir[s];
+	ir->h = impulses->h_ir[s];
+	ir->used = impulses->used[s];
+}
+
+static void _impulses_attach(convolver_state *state, convolver_impulses *impulses) {
+	int s;
+	state->impulses = impulses;
+	for(s = 0; s < state->segment_count; ++s)
+		_impulses_view(&state->segments[s].ir, impulses, s);
+}
+
+void convolver_impulses_release(void *impulses_) {
+	convolver_impulses *impulses = (convolver_impulses *)impulses_;
+
+	if(impulses && __sync_sub_and_fetch(&impulses->refs, 1) == 0) {
+		int s;
+		for(s = 0; s < impulses->segment_count; ++s)
+			_plan_drop(impulses->plan[s]);
+		_arena_close(impulses->arena);
+	}
+}
+
+/* Exported spectra start with a header, which says how they were laid out,
+ * followed by each spectrum in the order they are staged, its real plane,
+ * then its imaginary plane. Only libraries that transform alike can share
+ * them, which is all of them but vDSP, which scales its output, and the built
+ * in transforms, which leave the bins in bit reversed order. Where segments
+ * were transformed by libraries that don't, the format is mixed, and the
+ * header is followed by the format of each segment. Sets stored in half
+ * precision are exported as full floats all the same. */
+
+#define CONVOLVER_SPECTRA_HEADER 4 /* format, impulse size, head size, latency */
+#define CONVOLVER_SPECTRA_MIXED 0
+
+static int _impulses_format(const convolver_impulses *impulses) {
+	int format = _ffts[impulses->plan[0]->fft].format;
+	int s;
+	for(s = 1; s < impulses->segment_count; ++s) {
+		if(_ffts[impulses->plan[s]->fft].format != format)
+			return CONVOLVER_SPECTRA_MIXED;
+	}
+	return format;
+}
+
+/* How many floats the spectra take, past the header. */
+
+static int _impulses_floats(const convolver_impulses *impulses) {
+	int total_channels = _channels_for(impulses->mode, impulses->inputs, impulses->outputs);
+	int count = 0, s;
+	for(s = 0; s < impulses->segment_count; ++s)
+		count += total_channels * impulses->partitions[s] * impulses->fftlen[s];
+	return count;
+}
+
+int convolver_impulses_export(void *impulses_, float *out) {
+	convolver_impulses *impulses = (convolver_impulses *)impulses_;
+	int total_channels, count, format, i, s;
+
+	if(!impulses)
+		return 0;
+
+	total_channels = _channels_for(impulses->mode, impulses->inputs, impulses->outputs);
+	format = _impulses_format(impulses);
+
+	count = CONVOLVER_SPECTRA_HEADER + _impulses_floats(impulses);
+	if(format == CONVOLVER_SPECTRA_MIXED)
+		count += impulses->segment_count;
+
+	if(out) {
+		*out++ = format;
+		*out++ = impulses->impulselen;
+		*out++ = impulses->head;
+		*out++ = impulses->latency;
+
+		if(format == CONVOLVER_SPECTRA_MIXED) {
+			for(s = 0; s < impulses->segment_count; ++s)
+				*out++ = _ffts[impulses->plan[s]->fft].format;
+		}
+
+		for(s = 0; s < impulses->segment_count; ++s) {
+			int bins = impulses->fftlen[s] / 2;
+			for(i = 0; i < total_channels * impulses->partitions[s]; ++i) {
+				if(impulses->half) {
+					_half_load(bins, out, &impulses->h_ir[s][i]);
+				} else {
+					memcpy(out, impulses->f_ir[s][i].realp, sizeof(float) * bins);
+					memcpy(out + bins, impulses->f_ir[s][i].imagp, sizeof(float) * bins);
+				}
+				out += bins * 2;
+			}
+		}
+	}
+
+	return count;
+}
+
+/* The pool threads wait for a new batch of tasks, and take them in turn with
+ * the calling thread, until all of them are taken. Tasks are run without the
+ * lock, which is otherwise held throughout. */
+
+static void _pool_work(convolver_state *state, convolver_worker *worker) {
+	while(state->task_next < state->task_count) {
+		int task = state->task_next++;
+
+		pthread_mutex_unlock(&state->lock);
+		state->task(state, worker, task);
+		pthread_mutex_lock(&state->lock);
+
+		if(++state->task_done == state->task_count)
+			pthread_cond_signal(&state->done);
+	}
+}
+
+static void *_pool_thread(void *arg) {
+	convolver_worker *worker = (convolver_worker *)arg;
+	convolver_state *state = worker->state;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&state->lock);
+	for(;;) {
+		while(!state->quit && state->generation == generation)
+			pthread_cond_wait(&state->wake, &state->lock);
+		if(state->quit)
+			break;
+		generation = state->generation;
+		_pool_work(state, worker);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return NULL;
+}
+
+/* Run a batch of tasks on a segment, and return once all of them are done. */
+
+static void _pool_run(convolver_state *state, convolver_segment *seg, convolver_task task, int count) {
+	pthread_mutex_lock(&state->lock);
+
+	state->task = task;
+	state->task_seg = seg;
+	state->task_count = count;
+	state->task_next = 0;
+	state->task_done = 0;
+	++state->generation;
+	pthread_cond_broadcast(&state->wake);
+
+	_pool_work(state, &state->worker[0]);
+
+	while(state->task_done < state->task_count)
+		pthread_cond_wait(&state->done, &state->lock);
+
+	pthread_mutex_unlock(&state->lock);
+}
+
+static int _pool_start(convolver_state *state, const convolver_options *options) {
+	int i;
+
+	if(pthread_mutex_init(&state->lock, NULL) != 0)
+		return -1;
+	if(pthread_cond_init(&state->wake, NULL) != 0) {
+		pthread_mutex_destroy(&state->lock);
+		return -1;
+	}
+	if(pthread_cond_init(&state->done, NULL) != 0) {
+		pthread_cond_destroy(&state->wake);
+		pthread_mutex_destroy(&state->lock);
+		return -1;
+	}
+	state->pool_ready = 1;
+
+	for(i = 1; i < state->workers; ++i) {
+		convolver_worker *worker = &state->worker[i];
+
+		if(pthread_create(&worker->thread, NULL, _pool_thread, worker) != 0)
+			return -1;
+		++state->started;
+
+#ifdef __linux__
+		if(options->pin_threads) {
+			cpu_set_t set;
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			if(cpus < 1)
+				cpus = 1;
+			CPU_ZERO(&set);
+			CPU_SET((options->first_cpu + i - 1) % cpus, &set);
+			pthread_setaffinity_np(worker->thread, sizeof(set), &set);
+		}
+#endif
+	}
+
+	return 0;
+}
+
+static void _pool_stop(convolver_state *state) {
+	int i;
+
+	if(!state->pool_ready)
+		return;
+
+	pthread_mutex_lock(&state->lock);
+	state->quit = 1;
+	pthread_cond_broadcast(&state->wake);
+	pthread_mutex_unlock(&state->lock);
+
+	for(i = 1; i <= state->started; ++i)
+		pthread_join(state->worker[i].thread, NULL);
+
+	pthread_cond_destroy(&state->done);
+	pthread_cond_destroy(&state->wake);
+	pthread_mutex_destroy(&state->lock);
+	state->pool_ready = 0;
+}
+
+/* Impulses can be cut short where what is left of their tails carries less
+ * energy than the error allowed, relative to each channel's total. Every
+ * channel keeps at least as much as it needs, and the longest of them sets
+ * the size for all. A fade out follows that, so the cut doesn't click, and
+ * as it only covers what could have been cut, it stays within the error. */
+
+#define CONVOLVER_TRIM_FADE 512 /* longest fade out at the end of a trimmed impulse */
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static int _trim_channel(const float *impulse, int stride, int size, float db) {
+	double total = 0.0, tail = 0.0, limit;
+	int n;
+
+	for(n = 0; n < size; ++n)
+		total += (double)impulse[n * stride] * (double)impulse[n * stride];
+
+	limit = total * pow(10.0, -fabs(db) / 10.0);
+
+	for(n = size; n > 0; --n) {
+		double energy = (double)impulse[(n - 1) * stride] * (double)impulse[(n - 1) * stride];
+		if(tail + energy > limit)
+			break;
+		tail += energy;
+	}
+
+	return n;
+}
+
+static int _trim_length(const float *const *impulse, int impulse_size, const int *sizes, int mode, int inputs, int outputs, float db, int *fade) {
+	int impulse_count = (mode == 2) ? inputs : 1;
+	int channels = _channels_for(mode, inputs, outputs) / impulse_count;
+	int i, j, size = 1;
+
+	for(i = 0; i < impulse_count; ++i) {
+		for(j = 0; j < channels; ++j) {
+			int length = _trim_channel(impulse[i] + j, channels, sizes ? sizes[i] : impulse_size, db);
+			if(length > size)
+				size = length;
+		}
+	}
+
+	*fade = size / 8;
+	if(*fade > CONVOLVER_TRIM_FADE)
+		*fade = CONVOLVER_TRIM_FADE;
+	if(*fade > impulse_size - size)
+		*fade = impulse_size - size;
+
+	return size + *fade;
+}
+
+/* A raised cosine from one where the fade starts down to nothing just past
+ * the end of the impulse. */
+
+static float _trim_gain(int fade, int size, int n) {
+	int start = size - fade;
+	if(n < start)
+		return 1.0f;
+	return 0.5f + 0.5f * cosf((float)M_PI * (float)(n - start + 1) / (float)(fade + 1));
+}
+
+int convolver_trim(float *const *impulse, int impulse_size, int input_channels, int output_channels, int mode, float db) {
+	int impulse_count, channels, size, fade, i, j, k;
+
+	if(!impulse || impulse_size < 1 || mode < 0 || mode > 2 || input_channels < 1 || output_channels < 1)
+		return -1;
+
+	size = _trim_length((const float *const *)impulse, impulse_size, NULL, mode, input_channels, output_channels, db, &fade);
+
+	impulse_count = (mode == 2) ? input_channels : 1;
+	channels = _channels_for(mode, input_channels, output_channels) / impulse_count;
+
+	for(i = 0; i < impulse_count; ++i) {
+		for(j = 0; j < channels; ++j) {
+			for(k = size - fade; k < size; ++k)
+				impulse[i][j + k * channels] *= _trim_gain(fade, size, k);
+		}
+	}
+
+	return size;
+}
+
+/* The reduced rate paths decimate their input with a windowed sinc, which
+ * passes up to a quarter of the reduced rate, and interpolate their output
+ * with the same filter. Each impulse is filtered the same way, without any
+ * delay, and sampled at the reduced rate. The delay of the two filters is
+ * taken out of the impulse, less the latency of the rest of the paths, so
+ * they all line up, and only what comes earlier than that is lost. */
+
+#define CONVOLVER_LOW_TAPS 16 /* filter taps per phase of the reduced rate paths */
+#define CONVOLVER_LOW_CHUNK 1024 /* full rate samples run through them at a time */
+
+static int _low_taps(const convolver_state *state) {
+	return CONVOLVER_LOW_TAPS * state->low_factor;
+}
+
+static int _low_delay(const convolver_state *state) {
+	return _low_taps(state) - 2;
+}
+
+/* How far the output lags, which a direct head takes out of the latency the
+ * segments run with. */
+
+static int _output_latency(const convolver_state *state) {
+	return state->latency - state->direct;
+}
+
+static void _low_filter_make(float *h, int factor, int taps) {
+	int n, length = taps - 1, center = (length - 1) / 2;
+	double cutoff = 0.25 / (double)factor, sum = 0.0;
+
+	for(n = 0; n < length; ++n) {
+		double x = (double)(n - center);
+		double sinc = (n == center) ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+		double window = 0.42 - 0.5 * cos(2.0 * M_PI * n / (length - 1)) + 0.08 * cos(4.0 * M_PI * n / (length - 1));
+		h[n] = (float)(sinc * window);
+		sum += h[n];
+	}
+	for(n = 0; n < length; ++n)
+		h[n] = (float)(h[n] / sum);
+	h[length] = 0.0f;
+}
+
+static void _low_carve(convolver_state *state, const convolver_options *options, convolver_arena *arena) {
+	int i, taps;
+
+	if(!options || !options->lowpass_inputs || state->mode != 2)
+		return;
+
+	state->low_factor = options->lowpass_factor > 1 ? options->lowpass_factor : 8;
+	taps = _low_taps(state);
+
+	state->lowpass = (char *)_arena_take(arena, state->inputs);
+	state->low_inputs = (int *)_arena_take(arena, sizeof(int) * state->inputs);
+	state->low_count = 0;
+	for(i = 0; i < state->inputs && i < 32; ++i) {
+		if(options->lowpass_inputs & (1u << i)) {
+			if(arena->base) {
+				state->lowpass[i] = 1;
+				state->low_inputs[state->low_count] = i;
+			}
+			++state->low_count;
+		}
+	}
+	if(!state->low_count)
+		return;
+
+	/* Whatever latency is left over after the filters lets the reduced rate
+	 * convolver work in blocks, which is much cheaper. */
+
+	i = (_output_latency(state) - _low_delay(state)) / state->low_factor;
+	if(i >= CONVOLVER_MIN_SIZE) {
+		for(state->low_latency = CONVOLVER_MIN_SIZE; state->low_latency * 2 <= i && state->low_latency < CONVOLVER_MAX_SIZE; state->low_latency *= 2)
+			;
+	}
+
+	/* With less latency than the filters delay them, the start of each of
+	 * these impulses would come out too late, so that much of it is run by
+	 * the full rate segments instead, as with any other input. The filtered
+	 * impulse also rings for half the filter ahead of where that part ends,
+	 * which the reduced rate one must still reach. */
+
+	state->low_head = _low_delay(state) + state->low_latency * state->low_factor - _output_latency(state) + _low_delay(state) / 2;
+	if(state->low_head < 0)
+		state->low_head = 0;
+
+	state->low_filter = _arena_floats(arena, taps);
+	state->low_reverse = _arena_floats(arena, taps);
+	state->low_phases = _arena_floats(arena, taps);
+	state->low_hist = _arena_floats(arena, taps * 2 * state->low_count);
+	state->low_out = _arena_floats(arena, CONVOLVER_LOW_TAPS * state->outputs);
+	state->low_y = _arena_floats(arena, (CONVOLVER_LOW_CHUNK / state->low_factor + 1) * state->low_count);
+	state->low_z = _arena_floats(arena, (CONVOLVER_LOW_CHUNK / state->low_factor + 1) * state->outputs);
+
+	if(!arena->base)
+		return;
+
+	_low_filter_make(state->low_filter, state->low_factor, taps);
+
+	/* The interpolator makes up for the samples it fills in between. */
+
+	for(i = 0; i < taps; ++i) {
+		int phase = i / CONVOLVER_LOW_TAPS, tap = i % CONVOLVER_LOW_TAPS;
+		state->low_reverse[i] = state->low_filter[taps - 1 - i];
+		state->low_phases[i] = state->low_filter[phase + tap * state->low_factor] * (float)state->low_factor;
+	}
+}
+
+/* Filter and sample the impulses of the reduced rate inputs, past the part
+ * run at full rate, and stage them into their own convolver, which is created
+ * the first time. */
+
+static void _low_stage(convolver_state *state, const float *const *impulse) {
+	int factor = state->low_factor;
+	int taps = _low_taps(state);
+	int center = (taps - 2) / 2;
+	int shift = _low_delay(state) + state->low_latency * factor - _output_latency(state);
+	int outputs = state->outputs;
+	int size, length, i, j, k, t;
+	float *low_impulse[32];
+
+	size = 0;
+	for(i = 0; i < state->low_count; ++i) {
+		int input = state->low_inputs[i];
+		int input_size = state->sizes ? state->sizes[input] : state->impulselen;
+		if(input_size > size)
+			size = input_size;
+	}
+
+	length = (size + center - shift + factor - 1) / factor;
+	if(length < 1)
+		length = 1;
+
+	for(i = 0; i < state->low_count; ++i)
+		low_impulse[i] = NULL;
+
+	for(i = 0; i < state->low_count; ++i) {
+		int input = state->low_inputs[i];
+		int input_size = state->sizes ? state->sizes[input] : state->impulselen;
+
+		if((low_impulse[i] = (float *)malloc(sizeof(float) * length * outputs)) == NULL)
+			goto done;
+
+		for(j = 0; j < outputs; ++j) {
+			for(k = 0; k < length; ++k) {
+				int at = k * factor + shift + center;
+				double sum = 0.0;
+				for(t = 0; t < taps - 1; ++t) {
+					int n = at - t;
+					if(n >= state->low_head && n < input_size) {
+						float sample = impulse[input][j + n * outputs];
+						if(state->trim_fade)
+							sample *= _trim_gain(state->trim_fade, state->impulselen, n);
+						sum += state->low_filter[t] * sample;
+					}
+				}
+				low_impulse[i][j + k * outputs] = (float)(sum * factor);
+			}
+		}
+	}
+
+	if(state->low) {
+		convolver_restage(state->low, (const float *const *)low_impulse);
+	} else {
+		convolver_options options;
+		memset(&options, 0, sizeof(options));
+		options.silence = state->silence;
+		options.latency = state->low_latency;
+		options.half_spectra = state->half;
+		options.huge_pages = state->huge;
+		state->low = convolver_create_ex((const float *const *)low_impulse, length, state->low_count, outputs, 2, &options);
+	}
+
+done:
+	for(i = 0; i < state->low_count; ++i)
+		free(low_impulse[i]);
+}
+
+/* The direct head runs a chunk of input at a time, after the history it
+ * needs, which is then moved along for the next. */
+
+#define CONVOLVER_DIRECT_CHUNK 256 /* samples run through the direct head at a time */
+
+static void _direct_carve(convolver_state *state, convolver_arena *arena) {
+	int taps = state->direct;
+	int total_channels = _total_channels(state);
+
+	state->direct_h = _arena_floats(arena, taps * total_channels);
+	state->direct_live = (char *)_arena_take(arena, total_channels);
+	state->direct_in = _arena_buffers(arena, state->inputs, taps - 1 + CONVOLVER_DIRECT_CHUNK);
+	state->direct_out = _arena_floats(arena, CONVOLVER_DIRECT_CHUNK);
+}
+
+/* The taps are copied as they are, as far as each impulse reaches, with the
+ * same fade as the rest, if it reaches back this far. */
+
+static void _direct_stage(convolver_state *state, const float *const *impulse) {
+	int taps = state->direct;
+	int total_channels = _total_channels(state);
+	int impulse_count = (state->mode == 2) ? state->inputs : 1;
+	int channels = total_channels / impulse_count;
+	int c, k;
+
+	for(c = 0; c < total_channels; ++c) {
+		int i = c / channels, j = c % channels;
+		int size = state->sizes && state->sizes[i] < state->impulselen ? state->sizes[i] : state->impulselen;
+		float *h = state->direct_h + c * taps;
+
+		if(state->lowpass && state->lowpass[i] && size > state->low_head)
+			size = state->low_head;
+
+		for(k = 0; k < taps; ++k) {
+			h[k] = k < size ? impulse[i][j + k * channels] : 0.0f;
+			if(state->trim_fade)
+				h[k] *= _trim_gain(state->trim_fade, state->impulselen, k);
+		}
+
+		state->direct_live[c] = (char)!_buffer_silent(h, taps, 0.0f);
+	}
+}
+
+/* Fully opaque convolver state created and returned here, otherwise NULL on
+ * failure. Users are welcome to change this to pass in a const pointer to an
+ * impulse and its size, which will be copied and no longer needed upon return.
+ * It is assumed that there will be one impulse per input channel, and that
+ * each impulse will have one channel per output. */
+
+void *convolver_create(const float *const *impulse, int impulse_size, int input_channels, int output_channels, int mode) {
+	return convolver_create_ex(impulse, impulse_size, input_channels, output_channels, mode, NULL);
+}
+
+/* Check the parameters, and lay out the segments, without allocating any of
+ * their buffers yet. */
+
+static int _convolver_setup(convolver_state *state, int impulse_size, int input_channels, int output_channels, int mode, const convolver_options *options) {
+	int head, latency, size;
+
+	if(mode < 0 || mode > 2)
+		return -1;
+
+	if((mode == 0 || mode == 1) && input_channels != output_channels)
+		return -1;
+
+	if(impulse_size < 1 || input_channels < 1 || output_channels < 1)
+		return -1;
+
+	state->mode = mode;
+	state->inputs = input_channels;
+	state->outputs = output_channels;
+	state->paths = (mode == 2) ? input_channels * output_channels : input_channels;
+	state->impulselen = impulse_size;
+
+	/* With any latency to spare, the head partitions are as large as fit in
+	 * it, unless asked to be smaller, and all of the segments work on whole
+	 * blocks. Either way, the head size is rounded down to a power of two. */
+
+	latency = (options && options->latency >= CONVOLVER_MIN_SIZE) ? options->latency : 0;
+
+	if(options && options->block_size >= CONVOLVER_MIN_SIZE)
+		size = options->block_size;
+	else
+		size = latency ? latency : CONVOLVER_HEAD_SIZE;
+	if(latency && size > latency)
+		size = latency;
+
+	for(head = CONVOLVER_MIN_SIZE; head * 2 <= size && head < CONVOLVER_MAX_SIZE; head *= 2)
+		;
+
+	state->latency = latency ? head : 0;
+
+	return _convolver_layout(state, head);
+}
+
+/* Carves out everything the instance holds on to, past the state itself, of
+ * which the layout and options are already settled. */
+
+static void _convolver_carve(convolver_state *state, const int *sizes, const convolver_options *options, int low, convolver_arena *arena) {
+	int largest = state->segments[state->segment_count - 1].fftlen;
+	int largest_kiss = 0, largest_kiss4 = 0, batch = 1;
+	int i, j;
+
+	for(i = 0; i < state->segment_count; ++i) {
+		convolver_segment *seg = &state->segments[i];
+		if(seg->plan->fft == CONVOLVER_FFT_KISS || seg->plan->fft == CONVOLVER_FFT_KISS4)
+			largest_kiss = seg->fftlen;
+		if(seg->plan->fft == CONVOLVER_FFT_KISS4)
+			largest_kiss4 = seg->fftlen;
+		if(_fft_batch(seg) > batch)
+			batch = _fft_batch(seg);
+	}
+
+	if(sizes) {
+		int impulse_count = (state->mode == 2) ? state->inputs : 1;
+		state->sizes = (int *)_arena_take(arena, sizeof(int) * impulse_count);
+		if(arena->base)
+			memcpy(state->sizes, sizes, sizeof(int) * impulse_count);
+	}
+
+	/* Each worker gets work space for the largest segment, and the widest
+	 * batch of channels transformed at once, and with more than one, the
+	 * paths are summed apart before adding up. */
+
+	state->worker = (convolver_worker *)_arena_take(arena, sizeof(convolver_worker) * state->workers);
+	for(i = 0; i < state->workers; ++i) {
+		convolver_worker sizing, *worker = state->worker ? &state->worker[i] : &sizing;
+		worker->state = state;
+		for(j = 0; j < batch; ++j) {
+			_arena_spectrum(arena, &worker->f_out[j], largest);
+			worker->revspace[j] = _arena_floats(arena, largest);
+			_arena_spectrum(arena, &worker->f_fade[j], largest);
+			worker->fadespace[j] = _arena_floats(arena, largest);
+		}
+		if(largest_kiss)
+			_fft_kiss_carve(worker, largest_kiss, largest_kiss4, arena);
+	}
+
+	if(low)
+		_low_carve(state, options, arena);
+
+	if(state->direct)
+		_direct_carve(state, arena);
+
+	if(state->workers > 1) {
+		state->part_live = (char *)_arena_take(arena, state->paths * 2);
+		state->f_part = _arena_spectra(arena, state->paths, largest);
+		state->f_part_old = _arena_spectra(arena, state->paths, largest);
+	}
+
+	for(i = 0; i < state->segment_count; ++i)
+		_segment_carve(state, &state->segments[i], i == 0, arena);
+
+	/* The output work space reaches as far ahead as the last segment adds
+	 * to, and is used as a ring, moving along by one head block at a time.
+	 * All of the segments are multiples of the head size, so the head block
+	 * itself never wraps. */
+
+	state->outlen = state->segments[0].stepsize + state->latency + state->segments[state->segment_count - 1].offset;
+	state->outspace = _arena_buffers(arena, state->outputs, state->outlen);
+}
+
+/* Every constructor ends up here, with either impulses to stage into a new
+ * set, or an existing set to share, which is laid out the same. */
+
+static convolver_state *_convolver_create(const float *const *impulse, convolver_impulses *shared, int impulse_size, int input_channels, int output_channels, int mode, const convolver_options *options) {
+	convolver_options direct_options;
+	convolver_state layout, *state = NULL;
+	convolver_arena arena = { NULL, 0, 0 };
+	int *sizes = NULL;
+	int i;
+
+#ifdef CONVOLVER_X86_KERNELS
+	_spectrum_mac_select();
+#endif
+
+	/* The layout is worked out first, apart from the block it ends up in. */
+
+	memset(&layout, 0, sizeof(layout));
+
+	if(impulse_size < 1 || input_channels < 1 || output_channels < 1 || mode < 0 || mode > 2)
+		return NULL;
+
+	/* Impulses of their own sizes are only read that far, and each is no
+	 * larger than the size given for all of them. */
+
+	if(options && options->impulse_sizes) {
+		int impulse_count = (mode == 2) ? input_channels : 1;
+
+		if((sizes = (int *)malloc(sizeof(int) * impulse_count)) == NULL)
+			goto error;
+		for(i = 0; i < impulse_count; ++i) {
+			sizes[i] = options->impulse_sizes[i];
+			if(sizes[i] < 0)
+				sizes[i] = 0;
+			else if(sizes[i] > impulse_size)
+				sizes[i] = impulse_size;
+		}
+	}
+
+	/* Trimming only shortens the impulses staged here, and the fade is
+	 * applied to them, and any restaged after, as they are transformed. */
+
+	if(impulse && !shared && options && options->trim_db != 0.0f)
+		impulse_size = _trim_length(impulse, impulse_size, sizes, mode, input_channels, output_channels, options->trim_db, &layout.trim_fade);
+
+	/* A direct head stands in for the zero latency head, and the segments
+	 * then work on whole blocks of its size, with it as their latency. */
+
+	if(impulse && !shared && options && options->direct_taps >= CONVOLVER_MIN_SIZE && options->latency < CONVOLVER_MIN_SIZE) {
+		for(layout.direct = CONVOLVER_MIN_SIZE; layout.direct * 2 <= options->direct_taps && layout.direct < CONVOLVER_MAX_SIZE; layout.direct *= 2)
+			;
+		direct_options = *options;
+		direct_options.latency = layout.direct;
+		direct_options.block_size = 0;
+		options = &direct_options;
+	}
+
+	if(_convolver_setup(&layout, impulse_size, input_channels, output_channels, mode, options) < 0)
+		goto error;
+
+	if(shared && shared->segment_count != layout.segment_count)
+		goto error;
+
+	layout.half = shared ? shared->half : (options && options->half_spectra);
+	layout.huge = options && options->huge_pages;
+	layout.silence = (options && options->silence > 0) ? options->silence : 0;
+
+	layout.workers = (options && options->threads > 1) ? options->threads : 1;
+	if(layout.workers > CONVOLVER_MAX_THREADS)
+		layout.workers = CONVOLVER_MAX_THREADS;
+
+	/* Each segment transforms with the library its set was made with, or
+	 * else the one picked for its size, and holds it until deleted. */
+
+	for(i = 0; i < layout.segment_count; ++i) {
+		convolver_segment *seg = &layout.segments[i];
+		if(shared)
+			_plan_hold(seg->plan = shared->plan[i]);
+		else if((seg->plan = _plan_pick(seg->fftlenlog2, 0)) == NULL)
+			goto error;
+	}
+
+	/* Then the block is sized, with the state at the start of it, and
+	 * everything else is carved out after. */
+
+	_arena_take(&arena, sizeof(convolver_state));
+	_convolver_carve(&layout, sizes, options, impulse && !shared, &arena);
+
+	if(_arena_open(&arena, layout.huge) < 0)
+		goto error;
+
+	state = (convolver_state *)_arena_take(&arena, sizeof(convolver_state));
+	*state = layout;
+	_convolver_carve(state, sizes, options, impulse && !shared, &arena);
+	state->arena = arena;
+
+	if(shared) {
+		__sync_add_and_fetch(&shared->refs, 1);
+		_impulses_attach(state, shared);
+	} else {
+		convolver_impulses *impulses = _impulses_alloc(state, NULL);
+		if(!impulses)
+			goto error;
+		_impulses_attach(state, impulses);
+	}
+
+	if(impulse)
+		convolver_restage(state, impulse);
+
+	if(state->low_count && !state->low)
+		goto error;
+
+	if(state->workers > 1 && _pool_start(state, options) < 0)
+		goto error;
+
+	free(sizes);
+	return state;
+
+error:
+	free(sizes);
+	if(state)
+		convolver_delete(state);
+	else
+		_segments_drop(layout.segments, layout.segment_count);
+	return NULL;
+}
+
+void *convolver_create_ex(const float *const *impulse, int impulse_size, int input_channels, int output_channels, int mode, const convolver_options *options) {
+	return _convolver_create(impulse, NULL, impulse_size, input_channels, output_channels, mode, options);
+}
+
+/* An impulse set is staged by a throwaway instance on the calling thread,
+ * which hands over its reference on the way out. */
+
+void *convolver_impulses_create(const float *const *impulse, int impulse_size, int input_channels, int output_channels, int mode, const convolver_options *options) {
+	convolver_options temp;
+	convolver_state *state;
+	convolver_impulses *impulses;
+
+	if(options)
+		temp = *options;
+	else
+		memset(&temp, 0, sizeof(temp));
+	temp.threads = 0;
+	temp.lowpass_inputs = 0;
+	temp.direct_taps = 0;
+
+	state = _convolver_create(impulse, NULL, impulse_size, input_channels, output_channels, mode, &temp);
+	if(!state)
+		return NULL;
+
+	impulses = state->impulses;
+	__sync_add_and_fetch(&impulses->refs, 1);
+	convolver_delete(state);
+
+	return impulses;
+}
+
+/* Exported spectra are checked against the layout their header asks for, and
+ * then used in place, so nothing is transformed or copied. Each segment runs
+ * on a library that lays out its spectra as they were exported. */
+
+void *convolver_impulses_wrap(const float *spectra, int count, int input_channels, int output_channels, int mode) {
+	convolver_options options;
+	convolver_state *state;
+	convolver_impulses *impulses = NULL;
+	const float *formats = NULL;
+	int header = CONVOLVER_SPECTRA_HEADER;
+	int s;
+
+	if(!spectra || count < CONVOLVER_SPECTRA_HEADER || spectra[0] < 0 || spectra[0] >= CONVOLVER_SPECTRA_FORMATS)
+		return NULL;
+
+	if((state = (convolver_state *)calloc(1, sizeof(convolver_state))) == NULL)
+		return NULL;
+
+	memset(&options, 0, sizeof(options));
+	options.block_size = (int)spectra[2];
+	options.latency = (int)spectra[3];
+
+	if(_convolver_setup(state, (int)spectra[1], input_channels, output_channels, mode, &options) < 0 ||
+	   state->segments[0].stepsize != options.block_size || state->latency != options.latency)
+		goto error;
+
+	if(spectra[0] == CONVOLVER_SPECTRA_MIXED) {
+		if(count < CONVOLVER_SPECTRA_HEADER + state->segment_count)
+			goto error;
+		formats = spectra + CONVOLVER_SPECTRA_HEADER;
+		header += state->segment_count;
+	}
+
+	for(s = 0; s < state->segment_count; ++s) {
+		int format = formats ? (int)formats[s] : (int)spectra[0];
+		if(format < 1 || format >= CONVOLVER_SPECTRA_FORMATS)
+			goto error;
+		if((state->segments[s].plan = _plan_pick(state->segments[s].fftlenlog2, format)) == NULL)
+			goto error;
+	}
+
+	impulses = _impulses_alloc(state, spectra + header);
+	if(impulses && header + _impulses_floats(impulses) != count) {
+		convolver_impulses_release(impulses);
+		impulses = NULL;
+	}
+
+error:
+	_segments_drop(state->segments, state->segment_count);
+	free(state);
+	return impulses;
+}
+
+/* The layout follows from the set, so only the options for running the
+ * instance are taken from the caller. */
+
+void *convolver_create_shared(void *impulses_, const convolver_options *options) {
+	convolver_impulses *impulses = (convolver_impulses *)impulses_;
+	convolver_options temp;
+
+	if(!impulses)
+		return NULL;
+
+	if(options)
+		temp = *options;
+	else
+		memset(&temp, 0, sizeof(temp));
+	temp.latency = impulses->latency;
+	temp.block_size = impulses->head;
+
+	return _convolver_create(NULL, impulses, impulses->impulselen, impulses->inputs, impulses->outputs, impulses->mode, &temp);
+}
+
+/* Restage the convolver with a new impulse set, same size/parameters */
+void convolver_restage(void *state_, const float *const *impulse) {
+	convolver_state *state = (convolver_state *)state_;
+
+	float *impulse_temp;
+
+	int impulse_count;
+	int channels_per_impulse;
+	int impulse_size = state->impulselen;
+	int i, j, k, l, s;
+
+	/* A shared or borrowed set is left alone, and this instance gets a set
+	 * of its own instead. */
+
+	if(state->impulses->refs > 1 || state->impulses->borrowed) {
+		convolver_impulses *impulses = _impulses_alloc(state, NULL);
+		if(!impulses)
+			return;
+		convolver_impulses_release(state->impulses);
+		_impulses_attach(state, impulses);
+	}
+
+	if(state->mode == 0 || state->mode == 1)
+		impulse_count = 1;
+	else
+		impulse_count = state->inputs;
+
+	if(state->mode == 0)
+		channels_per_impulse = 1;
+	else
+		channels_per_impulse = state->outputs;
+
+	/* Since the FFT requires a full input for every transformaton, each
+	 * partition is copied into work space as large as the largest, and then
+	 * padded with silence. */
+
+	impulse_temp = state->worker[0].revspace[0];
+
+	for(s = 0; s < state->segment_count; ++s) {
+		convolver_segment *seg = &state->segments[s];
+		convolver_impulses *impulses = state->impulses;
+		int fftlen = seg->fftlen;
+		int stepsize = seg->stepsize;
+		int partitions = seg->partitions;
+		float scale;
+
+		/* The inverse transforms aren't normalized, so the impulse is scaled
+		 * down here once, rather than every output block. vDSP also doubles
+		 * the output of each forward transform. */
+
+		scale = 1.0 / (_ffts[seg->plan->fft].gain * (float)fftlen);
+
+		for(i = 0; i < impulse_count; ++i) {
+			int size = state->sizes && state->sizes[i] < impulse_size ? state->sizes[i] : impulse_size;
+			if(state->lowpass && state->lowpass[i] && size > state->low_head)
+				size = state->low_head;
+
+			for(j = 0; j < channels_per_impulse; ++j) {
+				for(k = 0; k < partitions; ++k) {
+					int index = (i * channels_per_impulse + j) * partitions + k;
+					int offset = state->direct + seg->offset + k * stepsize;
+					int length = size - offset;
+
+					/* Half precision spectra are transformed into work
+					 * space first, and converted from there. */
+
+					convolver_spectrum f_ir = impulses->half ? state->worker[0].f_out[0] : impulses->f_ir[s][index];
+
+					if(length > stepsize)
+						length = stepsize;
+					if(length <= 0) {
+						_spectrum_clear(seg, f_ir);
+						if(impulses->half)
+							_half_store(seg, &impulses->h_ir[s][index], f_ir);
+						continue;
+					}
+
+					for(l = 0; l < length; ++l) {
+						impulse_temp[l] = impulse[i][j + (offset + l) * channels_per_impulse] * scale;
+					}
+					if(state->trim_fade && offset + length > impulse_size - state->trim_fade) {
+						for(l = 0; l < length; ++l)
+							impulse_temp[l] *= _trim_gain(state->trim_fade, impulse_size, offset + l);
+					}
+					if(!_ffts[seg->plan->fft].pruned)
+						memset(impulse_temp + length, 0, sizeof(float) * (fftlen - length));
+
+					/* Our first actual transformation, which is cached for the life of this convolver. */
+					_fft_forward(seg, &state->worker[0], impulse_temp, length, f_ir);
+					if(impulses->half)
+						_half_store(seg, &impulses->h_ir[s][index], f_ir);
+				}
+			}
+		}
+	}
+
+	_impulses_measure(state->impulses);
+
+	if(state->direct)
+		_direct_stage(state, impulse);
+
+	if(state->low_count)
+		_low_stage(state, impulse);
+}
+
+/* Delete our opaque state, by stopping its threads, and dropping what it
+ * shares with others, then the block holding everything else. */
+
+void convolver_delete(void *state_) {
+	if(state_) {
+		convolver_state *state = (convolver_state *)state_;
+		_pool_stop(state);
+		_segments_drop(state->segments, state->segment_count);
+		convolver_impulses_release(state->impulses);
+		convolver_impulses_release(state->pending);
+		convolver_impulses_release(state->fading);
+		convolver_delete(state->low);
+		_arena_close(state->arena);
+	}
+}
+
+/* Everything is counted once per instance, even where shared. */
+
+size_t convolver_get_footprint(void *state_) {
+	size_t ret = 0;
+	if(state_) {
+		convolver_state *state = (convolver_state *)state_;
+		ret = _arena_footprint(&state->arena);
+		if(state->impulses)
+			ret += _arena_footprint(&state->impulses->arena);
+		ret += convolver_get_footprint(state->low);
+	}
+	return ret;
+}
+
+/* This resets the state between uses, if you need to restart output on startup. */
+
+void convolver_clear(void *state_) {
+	if(state_) {
+		/* Clearing for a new use setup only requires resetting the input and
+		 * output buffers, and the delay lines, not actually changing any of
+		 * the FFT state. */
+
+		int i, s;
+		convolver_state *state = (convolver_state *)state_;
+		for(s = 0; s < state->segment_count; ++s) {
+			convolver_segment *seg = &state->segments[s];
+			seg->buffered_in = 0;
+			seg->current = 0;
+			for(i = 0; i < state->inputs; ++i)
+				memset(seg->inspace[i], 0, sizeof(float) * seg->fftlen);
+			for(i = 0; i < state->inputs * seg->partitions; ++i)
+				_spectrum_clear(seg, seg->f_in[i]);
+			memset(seg->silent, 1, state->inputs * seg->partitions);
+			if(seg->f_acc) {
+				for(i = 0; i < state->outputs; ++i) {
+					_spectrum_clear(seg, seg->f_acc[i]);
+					_spectrum_clear(seg, seg->f_acc_old[i]);
+				}
+				memset(seg->acc_silent, 1, state->outputs * 2);
+			}
+		}
+		for(i = 0; i < state->outputs; ++i)
+			memset(state->outspace[i], 0, sizeof(float) * state->outlen);
+		state->outpos = 0;
+
+		if(state->low_count) {
+			convolver_clear(state->low);
+			memset(state->low_hist, 0, sizeof(float) * _low_taps(state) * 2 * state->low_count);
+			memset(state->low_out, 0, sizeof(float) * CONVOLVER_LOW_TAPS * state->outputs);
+			state->low_pos = 0;
+			state->low_phase = 0;
+		}
+
+		if(state->direct) {
+			for(i = 0; i < state->inputs; ++i)
+				memset(state->direct_in[i], 0, sizeof(float) * (state->direct - 1));
+		}
+	}
+}
+
+int convolver_get_latency(void *state_) {
+	if(state_) {
+		convolver_state *state = (convolver_state *)state_;
+		return _output_latency(state);
+	}
+	return 0;
+}
+
+/* Impulse sets are swapped in without locks. The caller's thread only ever
+ * exchanges the pending pointer, and the thread running the convolver takes
+ * it from there, so neither waits on the other. Both only ever read it
+ * atomically. */
+
+static convolver_impulses *_swap_pointer(convolver_impulses **ptr, convolver_impulses *value) {
+	convolver_impulses *old;
+	do {
+		old = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+	} while(!__sync_bool_compare_and_swap(ptr, old, value));
+	return old;
+}
+
+int convolver_swap(void *state_, void *impulses_) {
+	convolver_state *state = (convolver_state *)state_;
+	convolver_impulses *impulses = (convolver_impulses *)impulses_;
+	int s;
+
+	if(!state || !impulses || state->low_count || state->direct)
+		return -1;
+
+	if(impulses->inputs != state->inputs || impulses->outputs != state->outputs ||
+	   impulses->mode != state->mode || impulses->segment_count != state->segment_count)
+		return -1;
+
+	for(s = 0; s < state->segment_count; ++s) {
+		if(impulses->fftlen[s] != state->segments[s].fftlen || impulses->partitions[s] != state->segments[s].partitions ||
+		   impulses->plan[s] != state->segments[s].plan)
+			return -1;
+	}
+
+	__sync_add_and_fetch(&impulses->refs, 1);
+	convolver_impulses_release(_swap_pointer(&state->pending, impulses));
+
+	return 0;
+}
+
+/* Every segment runs its next block against both sets, and fades from one
+ * to the other over it. The old set is released once all of them have. */
+
+static void _swap_begin(convolver_state *state) {
+	convolver_impulses *impulses = _swap_pointer(&state->pending, NULL);
+	int s;
+
+	if(!impulses)
+		return;
+
+	state->fading = state->impulses;
+	state->fading_segments = state->segment_count;
+	_impulses_attach(state, impulses);
+
+	for(s = 0; s < state->segment_count; ++s)
+		_impulses_view(&state->segments[s].ir_old, state->fading, s);
+}
+
+static void _swap_segment_done(convolver_state *state, convolver_segment *seg) {
+	memset(&seg->ir_old, 0, sizeof(seg->ir_old));
+	if(--state->fading_segments == 0) {
+		convolver_impulses_release(state->fading);
+		state->fading = NULL;
+	}
+}
+
+/* Add to the output work space, at a position counted from the start of the
+ * current head block, wrapping around the end of the ring. */
+
+static void _output_add(convolver_state *state, int output, int pos, const float *in, int count) {
+	float *out = state->outspace[output];
+	int first;
+
+	pos += state->outpos;
+	if(pos >= state->outlen)
+		pos -= state->outlen;
+
+	first = state->outlen - pos;
+	if(first > count)
+		first = count;
+
+	_buffer_add(out + pos, in, first);
+	if(count > first)
+		_buffer_add(out, in + first, count - first);
+}
+
+/* Sum the products of a segment's partitions from the given one on, against
+ * the blocks in the delay line that line up with them, for one path, either
+ * into the output, or on top of what it already holds. Silent blocks are
+ * skipped, so this returns whether the output holds a sum at all. */
+
+static int _path_sum(convolver_state *state, convolver_segment *seg, const convolver_ir *ir, convolver_spectrum out, int path, int first, int summed) {
+	int k;
+	int partitions = seg->partitions;
+	int input = _path_input(state, path) * partitions;
+	int index = _path_impulse(state, path) * partitions;
+	int last = ir->used[_path_impulse(state, path)];
+
+	for(k = first; k < last; ++k) {
+		int slot = (seg->current + partitions - k) % partitions;
+		if(seg->silent[input + slot])
+			continue;
+		_ir_muladd(seg, out, seg->f_in[input + slot], ir, index + k, summed ? &out : NULL);
+		summed = 1;
+	}
+
+	return summed;
+}
+
+/* The same, for every path into one output. */
+
+static int _segment_sum(convolver_state *state, convolver_segment *seg, const convolver_ir *ir, convolver_spectrum out, int output, int first) {
+	int n, summed = 0;
+
+	for(n = 0; n < _output_paths(state); ++n)
+		summed = _path_sum(state, seg, ir, out, _output_path(state, output, n), first, summed);
+
+	return summed;
+}
+
+/* The zero latency head block so far, for every path into one output, on
+ * top of the sum of the older partitions, unless that is silent too. */
+
+static int _head_sum(convolver_state *state, convolver_segment *seg, const convolver_ir *ir, convolver_spectrum acc, int acc_silent, convolver_spectrum out, int output) {
+	int n, summed = 0;
+	int partitions = seg->partitions;
+
+	for(n = 0; n < _output_paths(state); ++n) {
+		int path = _output_path(state, output, n);
+		int input = _path_input(state, path) * partitions + seg->current;
+		int index = _path_impulse(state, path) * partitions;
+
+		if(seg->silent[input] || !ir->used[_path_impulse(state, path)])
+			continue;
+		_ir_muladd(seg, out, seg->f_in[input], ir, index, summed ? &out : acc_silent ? NULL : &acc);
+		summed = 1;
+	}
+
+	if(!summed && !acc_silent) {
+		_spectrum_copy(seg, out, acc);
+		summed = 1;
+	}
+
+	return summed;
+}
+
+/* A batch of outputs is transformed back together, so if any has a sum, the
+ * others must be cleared if they don't. Returns whether any does, as without,
+ * there is nothing to add to the output. */
+
+static int _outputs_live(convolver_segment *seg, convolver_spectrum *out, convolver_spectrum *fade, const int *live, const int *live_old, int n, int fading) {
+	int j, any = 0;
+
+	for(j = 0; j < n; ++j)
+		any |= live[j] | live_old[j];
+
+	if(any) {
+		for(j = 0; j < n; ++j) {
+			if(!live[j])
+				_spectrum_clear(seg, out[j]);
+			if(fading && !live_old[j])
+				_spectrum_clear(seg, fade[j]);
+		}
+	}
+
+	return any;
+}
+
+/* A segment's output is added as far ahead as it starts into the impulse. */
+
+static int _segment_outpos(convolver_state *state, convolver_segment *seg) {
+	return state->segments[0].stepsize - seg->stepsize + seg->offset + state->latency;
+}
+
+/* The input window holds the previous block, and the current one as far as
+ * it is filled. Past that is taken as zero, and left as it was. */
+
+static int _input_length(const convolver_segment *seg) {
+	return seg->stepsize + seg->buffered_in;
+}
+
+/* A silent input window transforms to nothing, so it is only marked as
+ * such in the delay line, and every sum skips it from then on. Reduced rate
+ * inputs are treated the same in segments past the part run at full rate. */
+
+static int _input_silent(convolver_state *state, convolver_segment *seg, int input) {
+	int slot = input * seg->partitions + seg->current;
+	int low = state->lowpass && state->lowpass[input] && state->direct + seg->offset >= state->low_head;
+	seg->silent[slot] = (char)(low || _buffer_silent(seg->inspace[input], _input_length(seg), state->silence));
+	return seg->silent[slot];
+}
+
+/* Transform the block so far of every input that isn't silent into the
+ * delay line, as many at a time as the library takes. */
+
+static void _inputs_forward(convolver_state *state, convolver_segment *seg, convolver_worker *worker) {
+	int i, n = 0, batch = _fft_batch(seg), partitions = seg->partitions;
+	convolver_spectrum *f_in = seg->f_in + seg->current;
+	float *in[CONVOLVER_MAX_BATCH];
+	convolver_spectrum out[CONVOLVER_MAX_BATCH];
+
+	for(i = 0; i < state->inputs; ++i) {
+		if(_input_silent(state, seg, i))
+			continue;
+		in[n] = seg->inspace[i];
+		out[n] = f_in[i * partitions];
+		if(++n == batch) {
+			_fft_forward_batch(seg, worker, in, _input_length(seg), out, n);
+			n = 0;
+		}
+	}
+	if(n)
+		_fft_forward_batch(seg, worker, in, _input_length(seg), out, n);
+}
 
-/* Fully opaque convolver state created and returned here, otherwise NULL on
- * failure. Users are welcome to change this to pass in a const pointer to an
- * impulse and its size, which will be copied and no longer needed upon return.
- * It is assumed that there will be one impulse per input channel, and that
- * each impulse will have one channel per output. */
+/* How many outputs from the given one are transformed back together. */
 
-void *convolver_create(const float *const *impulse, int impulse_size, int input_channels, int output_channels, int mode) {
-	convolver_state *state;
-	int fftlen, total_channels, i, j, k;
+static int _outputs_batch(const convolver_state *state, const convolver_segment *seg, int output) {
+	int n = _fft_batch(seg);
+	return (output + n < state->outputs) ? n : state->outputs - output;
+}
 
-	if(mode < 0 || mode > 2)
-		return 0;
+/* Run a whole block of a segment: transform it into the delay line, sum the
+ * products for each output, and add the result to the output. */
 
-	if((mode == 0 || mode == 1) && input_channels != output_channels)
-		return 0;
+static void _segment_convolve(convolver_state *state, convolver_segment *seg) {
+	int i, n;
+	int stepsize = seg->stepsize;
+	int outpos = _segment_outpos(state, seg);
+	convolver_worker *worker = &state->worker[0];
 
-	state = (convolver_state *)calloc(1, sizeof(convolver_state));
+	_inputs_forward(state, seg, worker);
 
-	if(!state)
-		return NULL;
+	for(i = 0; i < state->outputs; i += n) {
+		int j, live[CONVOLVER_MAX_BATCH], live_old[CONVOLVER_MAX_BATCH] = { 0 };
+		n = _outputs_batch(state, seg, i);
 
-	state->mode = mode;
-	state->inputs = input_channels;
-	state->outputs = output_channels;
-	if(mode == 0)
-		total_channels = 1;
-	else if(mode == 1)
-		total_channels = input_channels;
-	else if(mode == 2)
-		total_channels = input_channels * output_channels;
+		for(j = 0; j < n; ++j) {
+			live[j] = _segment_sum(state, seg, &seg->ir, worker->f_out[j], i + j, 0);
+			if(seg->ir_old.used)
+				live_old[j] = _segment_sum(state, seg, &seg->ir_old, worker->f_fade[j], i + j, 0);
+		}
 
-	state->stepsize = 512;
-	state->impulselen = impulse_size;
+		/* Once the input and the tail of the impulse are both silent,
+		 * there is nothing to transform back. */
 
-	fftlen = state->impulselen + state->stepsize + 1;
+		if(!_outputs_live(seg, worker->f_out, worker->f_fade, live, live_old, n, seg->ir_old.used != NULL))
+			continue;
 
-	{
-		// round up to a power of two
-		int pow = 1;
-		while(fftlen > 2) {
-			pow++;
-			fftlen /= 2;
+		_fft_inverse_batch(seg, worker, worker->f_out, worker->revspace, n);
+
+		if(seg->ir_old.used) {
+			_fft_inverse_batch(seg, worker, worker->f_fade, worker->fadespace, n);
+			for(j = 0; j < n; ++j)
+				_buffer_fade(worker->revspace[j] + stepsize, worker->fadespace[j] + stepsize, stepsize, 0, stepsize);
 		}
-		fftlen = 2 << pow;
-		state->fftlenover2 = 1 << pow;
-#ifndef USE_FFTW
-		state->fftlenlog2 = pow + 1;
-#endif
+
+		for(j = 0; j < n; ++j)
+			_output_add(state, i + j, outpos, worker->revspace[j] + stepsize, stepsize);
 	}
+}
 
-	state->fftlen = fftlen;
-	state->buffered_in = 0;
-	state->buffered_out = 0;
+/* The same, split across the pool. First each input is transformed, and its
+ * paths summed on their own, then each output adds up its paths. The zero
+ * latency head only sums its older partitions, for the next block. */
 
-	/* Prepare arrays for multiple inputs */
-	/* And we use kissfft's aligned malloc functions/macros to allocate these things. */
+static void _segment_input_task(convolver_state *state, convolver_worker *worker, int input) {
+	convolver_segment *seg = state->task_seg;
+	int first = seg->f_acc ? 1 : 0;
+	int n;
 
-#ifdef USE_FFTW
-	if((state->f_in = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * (fftlen / 2 + 1))) == NULL)
-#elif defined(__APPLE__)
-	if(_malloc_dspsplitcomplex(&state->f_in, fftlen) < 0)
-#else
-	if((state->f_in = (kiss_fft_cpx *)KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * (fftlen / 2 + 1))) == NULL)
-#endif
-		goto error;
+	if(!seg->f_acc && !_input_silent(state, seg, input))
+		_fft_forward(seg, worker, seg->inspace[input], _input_length(seg), seg->f_in[input * seg->partitions + seg->current]);
 
-#ifdef USE_FFTW
-	if((state->f_out = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * (fftlen / 2 + 1))) == NULL)
-#elif defined(__APPLE__)
-	if(_malloc_dspsplitcomplex(&state->f_out, fftlen) < 0)
-#else
-	if((state->f_out = (kiss_fft_cpx *)KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * (fftlen / 2 + 1))) == NULL)
-#endif
-		goto error;
+	for(n = 0; n < _input_paths(state); ++n) {
+		int path = _input_path(state, input, n);
+		state->part_live[path] = (char)_path_sum(state, seg, &seg->ir, state->f_part[path], path, first, 0);
+		state->part_live[state->paths + path] = seg->ir_old.used ? (char)_path_sum(state, seg, &seg->ir_old, state->f_part_old[path], path, first, 0) : 0;
+	}
+}
 
-#ifdef USE_FFTW
-	if((state->f_ir = (fftwf_complex **)calloc(sizeof(fftwf_complex *), total_channels)) == NULL)
-#elif defined(__APPLE__)
-	if((state->f_ir = (DSPSplitComplex *)calloc(sizeof(DSPSplitComplex), total_channels)) == NULL)
-#else
-	if((state->f_ir = (kiss_fft_cpx **)calloc(sizeof(kiss_fft_cpx *), total_channels)) == NULL)
-#endif
-		goto error;
-	for(i = 0; i < total_channels; ++i) {
-#ifdef USE_FFTW
-		if((state->f_ir[i] = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * (fftlen / 2 + 1))) == NULL)
-#elif defined(__APPLE__)
-		if(_malloc_dspsplitcomplex(&state->f_ir[i], fftlen) < 0)
-#else
-		if((state->f_ir[i] = (kiss_fft_cpx *)KISS_FFT_MALLOC(sizeof(kiss_fft_cpx) * (fftlen / 2 + 1))) == NULL)
-#endif
-			goto error;
+static int _paths_add(convolver_state *state, convolver_segment *seg, convolver_spectrum sum, const convolver_spectrum *part, const char *live, int output) {
+	int n, summed = 0;
+
+	for(n = 0; n < _output_paths(state); ++n) {
+		int path = _output_path(state, output, n);
+		if(!live[path])
+			continue;
+		if(summed)
+			_spectrum_add(seg, sum, sum, part[path]);
+		else
+			_spectrum_copy(seg, sum, part[path]);
+		summed = 1;
 	}
 
-#ifdef USE_FFTW
-	if((state->revspace = (float *)fftwf_malloc(sizeof(float) * fftlen)) == NULL)
-#elif defined(__APPLE__)
-	if((state->revspace = (float *)_mm_malloc(sizeof(float) * fftlen, 16)) == NULL)
-#else
-	if((state->revspace = (float *)KISS_FFT_MALLOC(sizeof(float) * fftlen)) == NULL)
-#endif
-		goto error;
+	return summed;
+}
 
-	if((state->outspace = (float **)calloc(sizeof(float *), output_channels)) == NULL)
-		goto error;
-	for(i = 0; i < output_channels; ++i) {
-#ifdef USE_FFTW
-		if((state->outspace[i] = (float *)fftwf_malloc(sizeof(float) * fftlen)) == NULL)
-#elif defined(__APPLE__)
-		if((state->outspace[i] = (float *)_mm_malloc(sizeof(float) * fftlen, 16)) == NULL)
-#else
-		if((state->outspace[i] = (float *)calloc(sizeof(float), fftlen)) == NULL)
-#endif
-			goto error;
-#if defined(USE_FFTW) || defined(__APPLE__)
-		memset(state->outspace[i], 0, sizeof(float) * fftlen);
-#endif
-	}
+static void _segment_output_task(convolver_state *state, convolver_worker *worker, int output) {
+	convolver_segment *seg = state->task_seg;
+	convolver_spectrum sum = seg->f_acc ? seg->f_acc[output] : worker->f_out[0];
+	convolver_spectrum sum_old = seg->f_acc ? seg->f_acc_old[output] : worker->f_fade[0];
+	int stepsize = seg->stepsize;
+	int live, live_old = 0;
 
-	if((state->inspace = (float **)calloc(sizeof(float *), input_channels)) == NULL)
-		goto error;
-	for(i = 0; i < input_channels; ++i) {
-#ifdef USE_FFTW
-		if((state->inspace[i] = (float *)fftwf_malloc(sizeof(float) * fftlen)) == NULL)
-#elif defined(__APPLE__)
-		if((state->inspace[i] = (float *)_mm_malloc(sizeof(float) * fftlen, 16)) == NULL)
-#else
-		if((state->inspace[i] = (float *)calloc(sizeof(float), fftlen)) == NULL)
-#endif
-			goto error;
-#if defined(USE_FFTW) || defined(__APPLE__)
-		memset(state->inspace[i], 0, sizeof(float) * fftlen);
-#endif
+	live = _paths_add(state, seg, sum, state->f_part, state->part_live, output);
+	if(seg->ir_old.used)
+		live_old = _paths_add(state, seg, sum_old, state->f_part_old, state->part_live + state->paths, output);
+
+	if(seg->f_acc) {
+		seg->acc_silent[output] = (char)!live;
+		seg->acc_silent[state->outputs + output] = (char)!live_old;
+		return;
 	}
 
-#ifdef USE_FFTW
-	if((state->p_fw = (fftwf_plan *)calloc(sizeof(fftwf_plan), input_channels)) == NULL)
-		goto error;
+	if(!_outputs_live(seg, &sum, &sum_old, &live, &live_old, 1, seg->ir_old.used != NULL))
+		return;
 
-	for(i = 0; i < input_channels; ++i) {
-		if((state->p_fw[i] = fftwf_plan_dft_r2c_1d(fftlen, state->inspace[i], state->f_in, FFTW_ESTIMATE)) == NULL)
-			goto error;
+	_fft_inverse(seg, worker, sum, worker->revspace[0]);
+	if(seg->ir_old.used) {
+		_fft_inverse(seg, worker, sum_old, worker->fadespace[0]);
+		_buffer_fade(worker->revspace[0] + stepsize, worker->fadespace[0] + stepsize, stepsize, 0, stepsize);
 	}
-	if((state->p_bw = fftwf_plan_dft_c2r_1d(fftlen, state->f_out, state->revspace, FFTW_ESTIMATE)) == NULL)
-		goto error;
-#elif defined(__APPLE__)
-	if((state->setup = vDSP_create_fftsetup(state->fftlenlog2, FFT_RADIX2)) == NULL)
-		goto error;
-#else
-	if((state->cfg_fw = kiss_fftr_alloc(fftlen, 0, NULL, NULL)) == NULL)
-		goto error;
-	if((state->cfg_bw = kiss_fftr_alloc(fftlen, 1, NULL, NULL)) == NULL)
-		goto error;
-#endif
+	_output_add(state, output, _segment_outpos(state, seg), worker->revspace[0] + stepsize, stepsize);
+}
 
-	convolver_restage(state, impulse);
+/* Input sample data is fed in here, never crossing the end of a head block,
+ * either interleaved, or as one plane per channel, from the given sample on. */
 
-	return state;
+static void convolver_write(void *state_, const float *input_samples, const float *const *input_planes, int done, int count) {
+	if(state_) {
+		convolver_state *state = (convolver_state *)state_;
+		convolver_segment *head = &state->segments[0];
 
-error:
-	convolver_delete(state);
-	return NULL;
-}
+		int i, j, n, s, input_channels;
+		int stepsize, offset;
+		input_channels = state->inputs;
+		stepsize = head->stepsize;
+		offset = head->buffered_in;
+
+		for(s = 0; s < state->segment_count; ++s) {
+			convolver_segment *seg = &state->segments[s];
+			const float *input = input_samples;
+			if(input_planes) {
+				for(i = 0; i < input_channels; ++i)
+					memcpy(seg->inspace[i] + seg->stepsize + seg->buffered_in, input_planes[i] + done, count * sizeof(float));
+				seg->buffered_in += count;
+				continue;
+			}
+			for(j = 0; j < count; ++j) {
+				for(i = 0; i < input_channels; ++i)
+					seg->inspace[i][seg->stepsize + seg->buffered_in] = input[i];
+				input += input_channels;
+				++seg->buffered_in;
+			}
+		}
 
-/* Restage the convolver with a new impulse set, same size/parameters */
-void convolver_restage(void *state_, const float *const *impulse) {
-	convolver_state *state = (convolver_state *)state_;
+		/* Without latency, every call convolves the head block so far, and
+		 * adds the samples it just added to the output. */
 
-	float *impulse_temp;
+		if(!state->latency) {
+			convolver_worker *worker = &state->worker[0];
 
-	int impulse_count;
-	int channels_per_impulse;
-	int fftlen = state->fftlen;
-	int impulse_size = state->impulselen;
-	int i, j, k;
-	int lenover2 = state->fftlenover2;
+			/* First the input samples are transformed to frequency domain, like
+			 * the cached impulse was in the setup function. The rest of the
+			 * block is taken as zero. This lands in the delay line, where it
+			 * is overwritten until the block is full. */
 
-#ifdef USE_FFTW
-	fftwf_plan p;
-	fftwf_complex **f_ir = state->f_ir;
-#elif defined(__APPLE__)
-	int log2n = state->fftlenlog2;
-	FFTSetup setup = state->setup;
-	DSPSplitComplex *f_ir = state->f_ir;
-#else
-	kiss_fftr_cfg cfg_fw = state->cfg_fw;
-	kiss_fft_cpx **f_ir = state->f_ir;
-#endif
+			_inputs_forward(state, head, worker);
 
-	if(state->mode == 0 || state->mode == 1)
-		impulse_count = 1;
-	else if(state->mode == 2)
-		impulse_count = state->inputs;
+			for(i = 0; i < state->outputs; i += n) {
+				int live[CONVOLVER_MAX_BATCH], live_old[CONVOLVER_MAX_BATCH] = { 0 };
+				n = _outputs_batch(state, head, i);
 
-	if(state->mode == 0)
-		channels_per_impulse = 1;
-	else if(state->mode == 1 || state->mode == 2)
-		channels_per_impulse = state->outputs;
+				/* Then the first partition of every path into each output is
+				 * multiplied in, on top of the sum of the older ones, and the
+				 * whole is transformed back to time domain, a batch of outputs
+				 * at a time, unless it all comes to silence. */
 
-	/* Since the FFT requires a full input for every transformaton, we allocate
-	 * a temporary buffer, which we fill with the impulse, then pad with silence. */
+				for(j = 0; j < n; ++j) {
+					live[j] = _head_sum(state, head, &head->ir, head->f_acc[i + j], head->acc_silent[i + j], worker->f_out[j], i + j);
+					if(head->fade_write)
+						live_old[j] = _head_sum(state, head, &head->ir_old, head->f_acc_old[i + j], head->acc_silent[state->outputs + i + j], worker->f_fade[j], i + j);
+				}
 
-	if((impulse_temp = (float *)malloc(sizeof(float) * fftlen)) == NULL)
-		return;
+				if(!_outputs_live(head, worker->f_out, worker->f_fade, live, live_old, n, head->fade_write))
+					continue;
 
-	memset(impulse_temp + impulse_size, 0, sizeof(float) * (fftlen - impulse_size));
+				_fft_inverse_batch(head, worker, worker->f_out, worker->revspace, n);
 
-	for(i = 0; i < impulse_count; ++i) {
-		for(j = 0; j < channels_per_impulse; ++j) {
-			for(k = 0; k < impulse_size; ++k) {
-				impulse_temp[k] = impulse[i][j + k * channels_per_impulse];
-			}
+				/* A block faded into a new impulse set is run against both. */
 
-			/* Our first actual transformation, which is cached for the life of this convolver. */
-#ifdef USE_FFTW
-			p = fftwf_plan_dft_r2c_1d(fftlen, impulse_temp, f_ir[i * channels_per_impulse + j], FFTW_ESTIMATE);
-			if(p) {
-				fftwf_execute(p);
-				fftwf_destroy_plan(p);
+				if(head->fade_write) {
+					_fft_inverse_batch(head, worker, worker->f_fade, worker->fadespace, n);
+					for(j = 0; j < n; ++j)
+						_buffer_fade(worker->revspace[j] + stepsize + offset, worker->fadespace[j] + stepsize + offset, count, offset, stepsize);
+				}
+
+				/* Only the second half of the window is valid output. */
+
+				for(j = 0; j < n; ++j)
+					_buffer_add(state->outspace[i + j] + state->outpos + offset, worker->revspace[j] + stepsize + offset, count);
 			}
-#elif defined(__APPLE__)
-			vDSP_ctoz((DSPComplex *)impulse_temp, 2, &f_ir[i * channels_per_impulse + j], 1, lenover2);
-			vDSP_fft_zrip(setup, &f_ir[i * channels_per_impulse + j], 1, log2n, FFT_FORWARD);
-#else
-			kiss_fftr(cfg_fw, impulse_temp, f_ir[i * channels_per_impulse + j]);
-#endif
 		}
 	}
-
-	free(impulse_temp);
 }
 
-/* Delete our opaque state, by freeing all of its member structures, then the
- * top level structure itself. */
+/* Once a head block is complete, every segment with a complete block runs
+ * it, then slides it into the first half of its input window. The output
+ * block just finished is cleared, to be reused at the far end of the ring. */
 
-void convolver_delete(void *state_) {
-	if(state_) {
-		int i, input_channels, output_channels, total_channels;
-		convolver_state *state = (convolver_state *)state_;
-		input_channels = state->inputs;
-		output_channels = state->outputs;
-		if(state->mode == 0)
-			total_channels = 1;
-		else if(state->mode == 1)
-			total_channels = input_channels;
-		else if(state->mode == 2)
-			total_channels = input_channels * output_channels;
-#ifdef USE_FFTW
-		if(state->p_fw) {
-			for(i = 0; i < input_channels; ++i) {
-				if(state->p_fw[i])
-					fftwf_destroy_plan(state->p_fw[i]);
+static void convolver_advance(void *state_) {
+	convolver_state *state = (convolver_state *)state_;
+	int i, s;
+
+	if(!state->fading && __atomic_load_n(&state->pending, __ATOMIC_ACQUIRE))
+		_swap_begin(state);
+
+	for(s = 0; s < state->segment_count; ++s) {
+		convolver_segment *seg = &state->segments[s];
+		int partitions = seg->partitions;
+		int stepsize = seg->stepsize;
+
+		if(seg->buffered_in < stepsize)
+			continue;
+
+		/* The zero latency head block is already in the delay line, and the
+		 * older partitions are summed for the next block. If that block was
+		 * just faded, the fade is over, otherwise one may be starting. */
+
+		if(seg->f_acc) {
+			seg->current = (seg->current + 1) % partitions;
+
+			if(seg->fade_write) {
+				seg->fade_write = 0;
+				_swap_segment_done(state, seg);
 			}
-			free(state->p_fw);
 		}
-		if(state->p_bw)
-			fftwf_destroy_plan(state->p_bw);
-#elif defined(__APPLE__)
-		if(state->setup)
-			vDSP_destroy_fftsetup(state->setup);
-#else
-		if(state->cfg_fw)
-			kiss_fftr_free(state->cfg_fw);
-		if(state->cfg_bw)
-			kiss_fftr_free(state->cfg_bw);
-#endif
-		if(state->f_ir) {
-			for(i = 0; i < total_channels; ++i) {
-#if !defined(USE_FFTW) && defined(__APPLE__)
-				_free_dspsplitcomplex(&state->f_ir[i]);
-#else
-				if(state->f_ir[i])
-#ifdef USE_FFTW
-					fftwf_free(state->f_ir[i]);
-#else
-					KISS_FFT_FREE(state->f_ir[i]);
-#endif
-#endif
+
+		if(state->workers > 1 && stepsize * partitions >= CONVOLVER_THREAD_MIN) {
+			_pool_run(state, seg, _segment_input_task, state->inputs);
+			_pool_run(state, seg, _segment_output_task, state->outputs);
+		} else if(seg->f_acc) {
+			for(i = 0; i < state->outputs; ++i) {
+				seg->acc_silent[i] = (char)!_segment_sum(state, seg, &seg->ir, seg->f_acc[i], i, 1);
+				seg->acc_silent[state->outputs + i] = (char)!(seg->ir_old.used && _segment_sum(state, seg, &seg->ir_old, seg->f_acc_old[i], i, 1));
 			}
-			free(state->f_ir);
+		} else {
+			_segment_convolve(state, seg);
 		}
-#if !defined(USE_FFTW) && defined(__APPLE__)
-		_free_dspsplitcomplex(&state->f_out);
-#else
-		if(state->f_out)
-#ifdef USE_FFTW
-			fftwf_free(state->f_out);
-#else
-			KISS_FFT_FREE(state->f_out);
-#endif
-#endif
-#if !defined(USE_FFTW) && defined(__APPLE__)
-		_free_dspsplitcomplex(&state->f_in);
-#else
-		if(state->f_in)
-#ifdef USE_FFTW
-			fftwf_free(state->f_in);
-#else
-			KISS_FFT_FREE(state->f_in);
-#endif
-#endif
-		if(state->revspace)
-#ifdef USE_FFTW
-			fftwf_free(state->revspace);
-#elif defined(__APPLE__)
-			_mm_free(state->revspace);
-#else
-			KISS_FFT_FREE(state->revspace);
-#endif
-		if(state->outspace) {
-			for(i = 0; i < output_channels; ++i) {
-				if(state->outspace[i])
-#ifdef USE_FFTW
-					fftwf_free(state->outspace[i]);
-#elif defined(__APPLE__)
-					_mm_free(state->outspace[i]);
-#else
-					free(state->outspace[i]);
-#endif
-			}
-			free(state->outspace);
+
+		if(seg->f_acc) {
+			if(seg->ir_old.used)
+				seg->fade_write = 1;
+		} else {
+			seg->current = (seg->current + 1) % partitions;
+			if(seg->ir_old.used)
+				_swap_segment_done(state, seg);
 		}
-		if(state->inspace) {
-			for(i = 0; i < input_channels; ++i) {
-				if(state->inspace[i])
-#ifdef USE_FFTW
-					fftwf_free(state->inspace[i]);
-#elif defined(__APPLE__)
-					_mm_free(state->inspace[i]);
-#else
-					free(state->inspace[i]);
-#endif
-			}
-			free(state->inspace);
+
+		/* The zero latency head transforms partial blocks, which must be
+		 * padded with silence, unless the library skips it. */
+
+		for(i = 0; i < state->inputs; ++i) {
+			memcpy(seg->inspace[i], seg->inspace[i] + stepsize, stepsize * sizeof(float));
+			if(seg->f_acc && !_ffts[seg->plan->fft].pruned)
+				memset(seg->inspace[i] + stepsize, 0, stepsize * sizeof(float));
 		}
-		free(state);
+
+		seg->buffered_in = 0;
+	}
+
+	{
+		int stepsize = state->segments[0].stepsize;
+		for(i = 0; i < state->outputs; ++i)
+			memset(state->outspace[i] + state->outpos, 0, stepsize * sizeof(float));
+		state->outpos += stepsize;
+		if(state->outpos >= state->outlen)
+			state->outpos = 0;
 	}
 }
 
-/* This resets the state between uses, if you need to restart output on startup. */
+/* The reduced rate paths run a chunk at a time. Every input sample goes into
+ * the decimator history, and every factor samples, it is filtered into a
+ * reduced rate sample. Returns how many there are. */
+
+static int _low_read(convolver_state *state, const float *input_samples, const float *const *input_planes, int done, int count) {
+	int factor = state->low_factor;
+	int taps = _low_taps(state);
+	int low_count = state->low_count;
+	int phase = state->low_phase;
+	int i, k, n, m;
+
+	/* The history is written twice, a filter length apart, so the newest
+	 * samples are always in one piece, ending at the second. */
+
+	for(n = 0, m = 0; n < count; ++n) {
+		if(++state->low_pos == taps)
+			state->low_pos = 0;
+		for(i = 0; i < low_count; ++i) {
+			int input = state->low_inputs[i];
+			float sample = input_planes ? input_planes[input][done + n] : input_samples[(done + n) * state->inputs + input];
+			float *hist = state->low_hist + i * taps * 2 + state->low_pos;
+			hist[0] = sample;
+			hist[taps] = sample;
+		}
 
-void convolver_clear(void *state_) {
-	if(state_) {
-		/* Clearing for a new use setup only requires resetting the input and
-		 * output buffers, not actually changing any of the FFT state. */
+		if(phase == 0) {
+			for(i = 0; i < low_count; ++i) {
+				const float *hist = state->low_hist + i * taps * 2 + state->low_pos + 1;
+				float sum = 0.0f;
+				for(k = 0; k < taps; ++k)
+					sum += state->low_reverse[k] * hist[k];
+				state->low_y[m * low_count + i] = sum;
+			}
+			++m;
+		}
 
-		int i, input_channels, output_channels, fftlen;
-		convolver_state *state = (convolver_state *)state_;
-		input_channels = state->inputs;
-		output_channels = state->outputs;
-		fftlen = state->fftlen;
-		state->buffered_in = 0;
-		state->buffered_out = 0;
-		for(i = 0; i < input_channels; ++i)
-			memset(state->inspace[i], 0, sizeof(float) * fftlen);
-		for(i = 0; i < output_channels; ++i)
-			memset(state->outspace[i], 0, sizeof(float) * fftlen);
+		if(++phase == factor)
+			phase = 0;
 	}
+
+	return m;
 }
 
-/* Input sample data is fed in here, one sample at a time. */
+/* Those are then convolved all at once, and each output sample is
+ * interpolated from the phase of the filter it falls on, and added on top of
+ * the rest of the paths. */
 
-static void convolver_write(void *state_, const float *input_samples, int count) {
-	if(state_) {
-		convolver_state *state = (convolver_state *)state_;
+static void _low_write(convolver_state *state, int low, float *output_samples, float *const *output_planes, int done, int count) {
+	int factor = state->low_factor;
+	int outputs = state->outputs;
+	int j, k, n, m;
 
-		int i, j, k, input_channels;
-		input_channels = state->inputs;
+	convolver_run(state->low, state->low_y, state->low_z, low);
+
+	for(n = 0, m = 0; n < count; ++n) {
+		int p = state->low_phase;
 
-		for(j = 0; j < count; ++j) {
-			for(i = 0; i < input_channels; ++i)
-				state->inspace[i][state->buffered_in] = input_samples[i];
-			input_samples += input_channels;
-			++state->buffered_in;
+		if(p == 0) {
+			for(j = 0; j < outputs; ++j) {
+				float *out = state->low_out + j * CONVOLVER_LOW_TAPS;
+				memmove(out + 1, out, sizeof(float) * (CONVOLVER_LOW_TAPS - 1));
+				out[0] = state->low_z[m * outputs + j];
+			}
+			++m;
 		}
 
-		for(j = 0; j < input_channels; ++j) {
-			memset(&state->inspace[j][state->buffered_in], 0, (state->fftlen - state->buffered_in) * sizeof(float));
+		for(j = 0; j < outputs; ++j) {
+			const float *out = state->low_out + j * CONVOLVER_LOW_TAPS;
+			const float *h = state->low_phases + p * CONVOLVER_LOW_TAPS;
+			float sum = 0.0f;
+			for(k = 0; k < CONVOLVER_LOW_TAPS; ++k)
+				sum += h[k] * out[k];
+			if(output_planes)
+				output_planes[j][done + n] += sum;
+			else
+				output_samples[(done + n) * outputs + j] += sum;
 		}
 
-		/* And every stepsize samples buffered, it convolves a new block of samples. */
+		if(++state->low_phase == factor)
+			state->low_phase = 0;
+	}
+}
 
-		{
-			int output_channels = state->outputs;
-			int fftlen;
-			int index;
-			float fftlen_if;
-			int lenover2 = state->fftlenover2;
-#ifdef USE_FFTW
-			fftwf_complex *f_in = state->f_in;
-			fftwf_complex *f_out = state->f_out;
-#elif defined(__APPLE__)
-			DSPSplitComplex *f_in = &state->f_in;
-			DSPSplitComplex *f_out = &state->f_out;
-			FFTSetup setup = state->setup;
-			int log2n = state->fftlenlog2;
-			float scale;
-#else
-			kiss_fft_cpx *f_in = state->f_in;
-			kiss_fft_cpx *f_out = state->f_out;
-#endif
-			float *revspace = state->revspace;
+/* The direct head takes its input a chunk at a time, after the history. */
 
-#if !defined(USE_FFTW) && defined(__APPLE__)
-			fftlen = state->fftlen;
-#endif
+static void _direct_read(convolver_state *state, const float *input_samples, const float *const *input_planes, int done, int count) {
+	int taps = state->direct;
+	int i, n;
 
-			if(state->mode == 0 || state->mode == 1) {
-				for(i = 0; i < input_channels; ++i) {
-					int index = i * state->mode;
-#ifdef USE_FFTW
-					fftwf_complex *f_ir = state->f_ir[index];
-#elif defined(__APPLE__)
-					DSPSplitComplex *f_ir = &state->f_ir[index];
-					float preserveIRNyq;
-					float preserveSigNyq;
+	for(i = 0; i < state->inputs; ++i) {
+		float *in = state->direct_in[i] + taps - 1;
+		if(input_planes) {
+			memcpy(in, input_planes[i] + done, count * sizeof(float));
+		} else {
+			for(n = 0; n < count; ++n)
+				in[n] = input_samples[(done + n) * state->inputs + i];
+		}
+	}
+}
+
+/* Every path into each output is run directly, over the chunk, and added on
+ * top of what the segments put out. */
+
+static void _direct_write(convolver_state *state, float *output_samples, float *const *output_planes, int done, int count) {
+	int taps = state->direct;
+	int i, j, n;
+
+	for(j = 0; j < state->outputs; ++j) {
+		float *out = state->direct_out;
+		int live = 0;
+
+		memset(out, 0, count * sizeof(float));
+
+		for(n = 0; n < _output_paths(state); ++n) {
+			int path = _output_path(state, j, n);
+			int channel = _path_impulse(state, path);
+			const float *in = state->direct_in[_path_input(state, path)] + taps - 1;
+			const float *h = state->direct_h + channel * taps;
+			if(!state->direct_live[channel])
+				continue;
+#ifdef CONVOLVER_X86_KERNELS
+			_direct_fir(out, in, h, taps, count);
 #else
-					kiss_fft_cpx *f_ir = state->f_ir[index];
+			_direct_fir_c(out, in, h, taps, 0, count);
 #endif
-					float *outspace;
-#if !defined(USE_FFTW) && defined(__APPLE__)
-					vDSP_ctoz((DSPComplex *)(state->inspace[i]), 2, f_in, 1, lenover2);
+			live = 1;
+		}
 
-					vDSP_fft_zrip(setup, f_in, 1, log2n, FFT_FORWARD);
+		if(!live)
+			continue;
 
-					preserveIRNyq = f_ir->imagp[0];
-					f_ir->imagp[0] = 0;
-					preserveSigNyq = f_in->imagp[0];
-					f_in->imagp[0] = 0;
+		if(output_planes) {
+			_buffer_add(output_planes[j] + done, out, count);
+		} else {
+			for(n = 0; n < count; ++n)
+				output_samples[(done + n) * state->outputs + j] += out[n];
+		}
+	}
 
-					vDSP_zvmul(f_in, 1, f_ir, 1, f_out, 1, lenover2, 1);
+	for(i = 0; i < state->inputs; ++i)
+		memmove(state->direct_in[i], state->direct_in[i] + count, (taps - 1) * sizeof(float));
+}
 
-					f_out->imagp[0] = preserveIRNyq * preserveSigNyq;
-					f_ir->imagp[0] = preserveIRNyq;
+/* With a direct head or reduced rate inputs, calls are run in chunks those
+ * can take at once. Each chunk of input goes to them before the segments
+ * write the output, so it may be written over the input. */
 
-					vDSP_fft_zrip(setup, f_out, 1, log2n, FFT_INVERSE);
+static int _run_chunk(const convolver_state *state, int count) {
+	if(state->direct && count > CONVOLVER_DIRECT_CHUNK)
+		count = CONVOLVER_DIRECT_CHUNK;
+	if(state->low_count && count > CONVOLVER_LOW_CHUNK)
+		count = CONVOLVER_LOW_CHUNK;
+	return count;
+}
 
-					vDSP_ztoc(f_out, 1, (DSPComplex *)revspace, 2, lenover2);
+static void _segments_run(convolver_state *state, const float *input_samples, float *output_samples, int count) {
+	convolver_segment *head = &state->segments[0];
 
-					scale = 1.0 / (4.0 * (float)fftlen);
-					vDSP_vsmul(revspace, 1, &scale, revspace, 1, fftlen);
+	while(count > 0) {
+		int offset = head->buffered_in;
+		int count_to_do = head->stepsize - offset;
+		if(count_to_do > count)
+			count_to_do = count;
 
-					outspace = state->outspace[i];
-					vDSP_vadd(revspace, 1, outspace, 1, outspace, 1, fftlen);
-#else
-#ifdef USE_FFTW
-					fftwf_execute(state->p_fw[i]);
-#else
-					kiss_fftr(state->cfg_fw, state->inspace[i], f_in);
-#endif
+		convolver_write(state, input_samples, NULL, 0, count_to_do);
 
-					for(k = 0, fftlen = lenover2; k < fftlen; ++k) {
-#ifdef USE_FFTW
-						float re = f_ir[k][0] * f_in[k][0] - f_ir[k][1] * f_in[k][1];
-						float im = f_ir[k][1] * f_in[k][0] + f_ir[k][0] * f_in[k][1];
-						f_out[k][0] = re;
-						f_out[k][1] = im;
-#else
-						float re = f_ir[k].r * f_in[k].r - f_ir[k].i * f_in[k].i;
-						float im = f_ir[k].i * f_in[k].r + f_ir[k].r * f_in[k].i;
-						f_out[k].r = re;
-						f_out[k].i = im;
-#endif
-					}
+		input_samples += count_to_do * state->inputs;
 
-#ifdef USE_FFTW
-					fftwf_execute(state->p_bw);
-#else
-					kiss_fftri(state->cfg_bw, f_out, revspace);
-#endif
+		int i, j, output_channels = state->outputs;
 
-					outspace = state->outspace[i];
-					for(j = 0, fftlen = state->fftlen, fftlen_if = 1.0f / (float)fftlen; j < fftlen; ++j)
-						outspace[j] += revspace[j] * fftlen_if;
-#endif
-				}
-			} else if(state->mode == 2) {
-				for(i = 0; i < input_channels; ++i) {
-					/* First the input samples are transformed to frequency domain, like
-					 * the cached impulse was in the setup function. */
+		for(j = 0; j < count_to_do; ++j) {
+			for(i = 0; i < output_channels; ++i) {
+				float sample = state->outspace[i][state->outpos + offset + j];
 
-#ifdef USE_FFTW
-					fftwf_execute(state->p_fw[i]);
-#elif defined(__APPLE__)
-					float preserveIRNyq;
-					float preserveSigNyq;
+				output_samples[i] = sample;
+			}
 
-					vDSP_ctoz((DSPComplex *)(state->inspace[i]), 2, f_in, 1, lenover2);
+			output_samples += output_channels;
+		}
 
-					vDSP_fft_zrip(setup, f_in, 1, log2n, FFT_FORWARD);
+		if(head->buffered_in == head->stepsize)
+			convolver_advance(state);
 
-					preserveSigNyq = f_in->imagp[0];
-					f_in->imagp[0] = 0;
-#else
-					kiss_fftr(state->cfg_fw, state->inspace[i], f_in);
-#endif
+		count -= count_to_do;
+	}
+}
 
-					for(j = 0; j < output_channels; ++j) {
-						/* Then we cross multiply the products of the frequency domain, the
-						 * real and imaginary values, into output real and imaginary pairs. */
+/* Call this to process samples */
 
-						int index = i * output_channels + j;
-#ifdef USE_FFTW
-						fftwf_complex *f_ir = state->f_ir[index];
-#elif defined(__APPLE__)
-						DSPSplitComplex *f_ir = &state->f_ir[index];
-						float scale;
-#else
-						kiss_fft_cpx *f_ir = state->f_ir[index];
-#endif
-						float *outspace;
-#if !defined(USE_FFTW) && defined(__APPLE__)
-						preserveIRNyq = f_ir->imagp[0];
-						f_ir->imagp[0] = 0;
+void convolver_run(void *state_, const float *input_samples, float *output_samples, int count) {
+	if(state_) {
+		convolver_state *state = (convolver_state *)state_;
+		int done = 0;
 
-						vDSP_zvmul(f_in, 1, f_ir, 1, f_out, 1, lenover2, 1);
+		while(done < count) {
+			int count_to_do = _run_chunk(state, count - done);
+			int low = 0;
 
-						f_ir->imagp[0] = preserveIRNyq;
-						f_out->imagp[0] = preserveIRNyq * preserveSigNyq;
-#else
-						for(k = 0, fftlen = lenover2; k < fftlen; ++k) {
-#ifdef USE_FFTW
-							float re = f_ir[k][0] * f_in[k][0] - f_ir[k][1] * f_in[k][1];
-							float im = f_ir[k][1] * f_in[k][0] + f_ir[k][0] * f_in[k][1];
-							f_out[k][0] = re;
-							f_out[k][1] = im;
-#else
-							float re = f_ir[k].r * f_in[k].r - f_ir[k].i * f_in[k].i;
-							float im = f_ir[k].i * f_in[k].r + f_ir[k].r * f_in[k].i;
-							f_out[k].r = re;
-							f_out[k].i = im;
-#endif
-						}
-#endif
+			if(state->direct)
+				_direct_read(state, input_samples, NULL, done, count_to_do);
 
-						/* Then we transform back from frequency to time domain. */
+			if(state->low_count)
+				low = _low_read(state, input_samples, NULL, done, count_to_do);
 
-#ifdef USE_FFTW
-						fftwf_execute(state->p_bw);
-#elif defined(__APPLE__)
-						vDSP_fft_zrip(setup, f_out, 1, log2n, FFT_INVERSE);
-						vDSP_ztoc(f_out, 1, (DSPComplex *)revspace, 2, lenover2);
-#else
-						kiss_fftri(state->cfg_bw, f_out, revspace);
-#endif
+			_segments_run(state, input_samples + done * state->inputs, output_samples + done * state->outputs, count_to_do);
 
-						/* Then we add the entire revspace block onto our output, dividing
-						 * each value by the total number of samples in the buffer. Remember,
-						 * since there is some overlap, this addition step is important. */
+			if(state->direct)
+				_direct_write(state, output_samples, NULL, done, count_to_do);
 
-#if !defined(USE_FFTW) && defined(__APPLE__)
-						scale = 1.0 / (4.0 * (float)fftlen);
-						vDSP_vsmul(revspace, 1, &scale, revspace, 1, fftlen);
+			if(state->low_count)
+				_low_write(state, low, output_samples, NULL, done, count_to_do);
 
-						outspace = state->outspace[j];
-						vDSP_vadd(revspace, 1, outspace, 1, outspace, 1, fftlen);
-#else
-						outspace = state->outspace[j];
-						for(k = 0, fftlen = state->fftlen, fftlen_if = 1.0f / (float)fftlen; k < fftlen; ++k)
-							outspace[k] += revspace[k] * fftlen_if;
-#endif
-					}
-				}
-			}
+			done += count_to_do;
+		}
+	}
+}
 
-			/* Output samples are now buffered and ready for retrieval. */
+static void _segments_run_planar(convolver_state *state, const float *const *input_planes, float *const *output_planes, int done, int count) {
+	convolver_segment *head = &state->segments[0];
 
-			state->buffered_out = state->buffered_in;
-			state->buffered_in = 0;
-		}
+	while(count > 0) {
+		int offset = head->buffered_in;
+		int count_to_do = head->stepsize - offset;
+		int i;
+		if(count_to_do > count)
+			count_to_do = count;
+
+		convolver_write(state, NULL, input_planes, done, count_to_do);
+
+		for(i = 0; i < state->outputs; ++i)
+			memcpy(output_planes[i] + done, state->outspace[i] + state->outpos + offset, count_to_do * sizeof(float));
+
+		if(head->buffered_in == head->stepsize)
+			convolver_advance(state);
+
+		done += count_to_do;
+		count -= count_to_do;
 	}
 }
 
-/* Call this to process samples */
+/* The same, with each channel in a plane of its own, which saves shuffling
+ * samples around, as the convolver works on planes internally. */
 
-void convolver_run(void *state_, const float *input_samples, float *output_samples, int count) {
+void convolver_run_planar(void *state_, const float *const *input_planes, float *const *output_planes, int count) {
 	if(state_) {
 		convolver_state *state = (convolver_state *)state_;
+		int done = 0;
 
-		while(count > 0) {
-			int count_to_do = count;
-			if(count_to_do > state->stepsize)
-				count_to_do = state->stepsize;
-
-			convolver_write(state_, input_samples, count_to_do);
-
-			input_samples += count_to_do * state->inputs;
+		while(done < count) {
+			int count_to_do = _run_chunk(state, count - done);
+			int low = 0;
 
-			int i, j, output_channels = state->outputs;
+			if(state->direct)
+				_direct_read(state, NULL, input_planes, done, count_to_do);
 
-			for(j = 0; j < count_to_do; ++j) {
-				for(i = 0; i < output_channels; ++i) {
-					float sample = state->outspace[i][j];
+			if(state->low_count)
+				low = _low_read(state, NULL, input_planes, done, count_to_do);
 
-					output_samples[i] = sample;
-				}
+			_segments_run_planar(state, input_planes, output_planes, done, count_to_do);
 
-				output_samples += output_channels;
-			}
+			if(state->direct)
+				_direct_write(state, NULL, output_planes, done, count_to_do);
 
-			for(i = 0; i < output_channels; ++i) {
-				float *outspace = state->outspace[i];
-				memmove(outspace, outspace + state->buffered_out, (state->fftlen - state->buffered_out) * sizeof(float));
-				memset(outspace + state->fftlen - state->buffered_out, 0, state->buffered_out * sizeof(float));
-			}
+			if(state->low_count)
+				_low_write(state, low, NULL, output_planes, done, count_to_do);
 
-			count -= state->buffered_out;
-			state->buffered_out = 0;
+			done += count_to_do;
 		}
 	}
 }
@@ -35,6 +35,8 @@
 #ifndef _SIMPLE_CONVOLVER_H_
 #define _SIMPLE_CONVOLVER_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -54,6 +56,132 @@ extern "C" {
  *      summed together. */
 void *convolver_create(const float *const *impulses, int impulse_size, int input_channels, int output_channels, int mode);
 
+/* Optional creation parameters for convolver_create_ex. Zeroed fields keep
+ * the defaults that convolver_create uses. */
+typedef struct convolver_options {
+	/* Output delay the caller can accept, in samples. With zero, output is
+	 * never delayed. Otherwise, the head of each impulse is split into the
+	 * largest power of two sized partitions that fit, at least 32 samples,
+	 * which is much cheaper when run a few samples at a time. */
+	int latency;
+
+	/* Size of the head partitions, which is also the block size the input
+	 * is processed in. Larger blocks cost less per sample, but take longer
+	 * to fill, and can't exceed the latency, if one is set. Rounded down to
+	 * a power of two, at least 32. With zero, it is 512 without latency, or
+	 * the largest that fits in it. */
+	int block_size;
+
+	/* Threads to split large blocks across, counting the calling thread.
+	 * Transforms and products run per input channel, then the sums per
+	 * output channel. The pool is started here, and never allocates after.
+	 * With zero or one, everything runs on the calling thread. */
+	int threads;
+
+	/* With nonzero, each pool thread is pinned to a CPU of its own, counting
+	 * up from first_cpu, where supported. */
+	int pin_threads;
+	int first_cpu;
+
+	/* Input blocks with every sample within this of zero are taken as
+	 * silence, and skip their transforms and products, which changes the
+	 * output by no more than they would have. With zero, only blocks of
+	 * exact silence are skipped. */
+	float silence;
+
+	/* With nonzero, each impulse is cut short where the energy left in its
+	 * tail falls this many dB below its total, and the longest of them sets
+	 * the size of all. It then fades out over part of what could have been cut.
+	 * This only applies to the impulses passed in with it, and restaging
+	 * then reads no more than the trimmed size. */
+	float trim_db;
+
+	/* Optionally, the size of each impulse, if they differ, with none larger
+	 * than impulse_size. Each is only read that far, and taken as silence
+	 * past it. Either way, each path only sums the partitions it needs to
+	 * reach the last part of its impulse channel that isn't silent. */
+	const int *impulse_sizes;
+
+	/* Inputs to run at a reduced rate, one bit per input channel, in mode 2
+	 * only, for channels with nothing above a quarter of that rate, such as
+	 * LFE. Each is decimated by lowpass_factor, 8 unless set, convolved at
+	 * that rate, and interpolated back up. The filters delay these paths by
+	 * 16 times the factor, less 2, samples. The start of each of their
+	 * impulses, as far as the latency falls short of that and half as much
+	 * again, is run at full rate like any other input, so none of it is
+	 * lost. Only instances staged from impulses do this, and they can't swap
+	 * impulse sets. */
+	unsigned int lowpass_inputs;
+	int lowpass_factor;
+
+	/* With nonzero, the transformed impulses are stored as 16 bit floats,
+	 * which halves the memory every block reads them from, and converted as
+	 * they are multiplied, with F16C where the CPU has it. Each spectrum is
+	 * scaled to make the most of the range, so every bin is within 2^-11 of
+	 * itself, and the output typically within -70 dB of full precision. Sets
+	 * made with this keep it, and are exported as full floats. */
+	int half_spectra;
+
+	/* With nonzero, and no latency, the first direct_taps of each impulse,
+	 * rounded down to a power of two, at least 32, are convolved one sample
+	 * at a time, and the rest in blocks of that size, which line up behind
+	 * them. Output is never delayed, and costs the same however few samples
+	 * are run at a time, unlike the zero latency head, which transforms each
+	 * partial block again. This sets the block size. Only instances staged
+	 * from impulses do this, and they can't swap impulse sets. */
+	int direct_taps;
+
+	/* With nonzero, the block each instance and impulse set made with this
+	 * is carved out of is backed by huge pages, where the system has them,
+	 * for fewer TLB misses on large spectra. On Linux, blocks of 2 MB and up
+	 * are mapped from the reserved pool, or else advised to be transparent
+	 * huge pages. Elsewhere, this is ignored. */
+	int huge_pages;
+} convolver_options;
+
+/* The same as above, with optional parameters, which may be NULL. */
+void *convolver_create_ex(const float *const *impulses, int impulse_size, int input_channels, int output_channels, int mode, const convolver_options *options);
+
+/* The same trimming, done ahead of time on impulses laid out as above, in
+ * place, including the fade out. Returns the size to keep, or -1 if the
+ * parameters are invalid. */
+int convolver_trim(float *const *impulses, int impulse_size, int input_channels, int output_channels, int mode, float db);
+
+/* Impulse sets hold the transformed impulses on their own, so any number of
+ * instances can share them read-only, each keeping only its stream state.
+ * They are created from the same parameters as above, of which latency and
+ * block_size decide the layout, which every instance of the set will use. */
+void *convolver_impulses_create(const float *const *impulses, int impulse_size, int input_channels, int output_channels, int mode, const convolver_options *options);
+
+/* Each set is reference counted, and freed once released by its creator and
+ * every instance using it, in any order, from any thread. */
+void convolver_impulses_release(void *);
+
+/* Copies the transformed impulses of a set out, as a flat array of floats,
+ * which can be saved, or built into a program. Returns how many floats it
+ * takes, and only returns that with NULL. */
+int convolver_impulses_export(void *, float *spectra);
+
+/* Makes an impulse set from exported spectra, which are used in place, so
+ * they must stay around until the set is released. Returns NULL if they
+ * were exported by a different FFT library, or for different channels. */
+void *convolver_impulses_wrap(const float *spectra, int count, int input_channels, int output_channels, int mode);
+
+/* A new instance using an impulse set, which may be released right after.
+ * Its latency and block size come from the set, and only the remaining
+ * options, which may be NULL, are taken from here. Restaging an instance
+ * of a shared set gives it a set of its own, leaving the others as they
+ * were. */
+void *convolver_create_shared(void *impulses, const convolver_options *options);
+
+/* This returns how many samples the output lags behind the input. */
+int convolver_get_latency(void *);
+
+/* This returns how many bytes an instance holds, which all come from one
+ * block, aligned to cache lines, counting the impulse set it runs, even if
+ * shared, and its reduced rate convolver, if any. */
+size_t convolver_get_footprint(void *);
+
 /* This function is for re-importing a modified impulse set into an existing
  * instance, with the same number of channels per input and output, so the
  * same number of impulses and channels per impulse. Useful if you are
@@ -61,16 +189,67 @@ void *convolver_create(const float *const *impulses, int impulse_size, int input
  * set. */
 void convolver_restage(void *, const float *const *impulses);
 
+/* Swaps in another impulse set, laid out the same, without waiting on the
+ * thread running the instance, and without clicks. This can be called from
+ * any one thread while another runs it. The new set is taken up at the next
+ * block, and each part of the impulse fades over to it across one block of
+ * its own. The instance keeps a reference to the set, and the one it drops
+ * afterwards is released on the running thread, so keep a reference of your
+ * own, and release it elsewhere, if that must never free memory. Returns -1
+ * if the set doesn't fit the instance, or was transformed by other libraries. */
+int convolver_swap(void *, void *impulses);
+
 /* Pass an instance of the convolver here to clean up when you're done with it */
 void convolver_delete(void *);
 
+/* Transforms are planned once per size, and shared by every instance in the
+ * process. With FFTW, plans made after this can take longer to find faster
+ * transforms, which is worth saving as wisdom, and loading on later runs.
+ * Other libraries ignore all of this, and the wisdom calls return -1. */
+#define CONVOLVER_PLAN_ESTIMATE 0
+#define CONVOLVER_PLAN_MEASURE 1
+#define CONVOLVER_PLAN_PATIENT 2
+void convolver_set_planning(int effort);
+int convolver_load_wisdom(const char *path);
+int convolver_save_wisdom(const char *path);
+
+/* Every FFT library available is built in, and which one runs is picked for
+ * each transform size, the first time it is used. Unless one is set here, or
+ * named in the CONVOLVER_FFT environment variable, as kiss, fftw, vdsp, split
+ * or kiss4, each of them is timed at that size, and the fastest is kept. This
+ * only applies to instances and impulse sets made after, and those made with
+ * different libraries can't swap sets. Returns -1 if the library isn't built
+ * in. kiss4 is kissfft built for SSE, which transforms up to four channels at
+ * once, one per lane, on a single thread. */
+#define CONVOLVER_FFT_AUTO 0
+#define CONVOLVER_FFT_KISS 1
+#define CONVOLVER_FFT_FFTW 2
+#define CONVOLVER_FFT_VDSP 3
+#define CONVOLVER_FFT_SPLIT 4
+#define CONVOLVER_FFT_KISS4 5
+#define CONVOLVER_FFT_COUNT 6
+int convolver_set_fft(int fft);
+
+/* Frees the shared plans that no instance or impulse set is using, and
+ * forgets which library was fastest. Plans still in use are kept, and freed
+ * by a later call, once everything using them is deleted or released. */
+void convolver_cleanup(void);
+
 /* This will clear the intermediate buffers of the convolver, useful for
  * restarting a stream with the same filter parameters. */
 void convolver_clear(void *);
 
-/* This will process N samples, in blocks of up to 512. */
+/* This will process N samples, with no added latency unless one was asked for.
+ * Internally, this works in blocks of the head partition size, 512 unless set
+ * otherwise. Without latency, calls that end on a block boundary are the
+ * cheapest, while any others redo the transform of the current block so far.
+ * The output may be written over the input, if it has no more channels. */
 void convolver_run(void *, const float *input, float *output, int count);
 
+/* The same, with one array of samples per input and output channel. Any of
+ * the output arrays may be one of the input arrays. */
+void convolver_run_planar(void *, const float *const *input, float *const *output, int count);
+
 #ifdef __cplusplus
 }
 #endif
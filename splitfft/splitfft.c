@@ -0,0 +1,690 @@
+/* vim: set et ts=4 sw=4 sts=4 ft=c:
+ *
+ * Copyright (C) 2016 Christopher Snowhill.  All rights reserved.
+ * https://github.com/kode54/fft-resampler
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* A real transform of n points is done as a complex transform of n / 2, of
+ * the even samples as the real parts, and the odd ones as the imaginary parts,
+ * which is then untangled into the real spectrum. That is the same trick
+ * kissfft and most others use.
+ *
+ * The complex transform runs in place on the split planes, decimating in
+ * frequency, in radix 2^2 stages, which are two radix 2 stages at a time, so
+ * they only cost as much as radix 4, but leave the bins in bit reversed order.
+ * With an odd number of radix 2 stages, one of them goes first, on its own.
+ * The last two stages of every 16 points are done together, in registers. The
+ * inverse is the same steps backwards, decimating in time.
+ *
+ * In bit reversed order, bin k and bin n / 2 - k, which are untangled
+ * together, still end up in the same block of positions, from 2^q up to
+ * 2^(q + 1), mirrored around its middle, so the untangling reads both ends of
+ * each block towards the middle, which vectorizes as well as it would in
+ * order. */
+
+#include "splitfft.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SPLITFFT_X86
+#include <immintrin.h>
+#endif
+
+#define SPLITFFT_MIN_LOG2 5
+#define SPLITFFT_MAX_LOG2 24
+#define SPLITFFT_MAX_STAGES 12 /* radix 4 stages, at most */
+
+struct splitfft_setup {
+	int half; /* complex points, half the real size */
+	int radix2; /* a radix 2 stage comes first */
+	int stages; /* radix 4 stages after it, the last two of which are 16 and 4 points */
+	const float *twiddle2; /* radix 2 stage, real then imaginary parts */
+	const float *twiddle[SPLITFFT_MAX_STAGES]; /* radix 4 stages, largest first, each of the three twiddles, real then imaginary */
+	const float *post; /* untangling, for the bin at each position, real then imaginary parts */
+	float *tables;
+	int avx2; /* AVX2 and FMA are there to use */
+};
+
+static unsigned int _bit_reverse(unsigned int p, int bits) {
+	unsigned int ret = 0;
+	int i;
+	for(i = 0; i < bits; ++i) {
+		ret = (ret << 1) | (p & 1);
+		p >>= 1;
+	}
+	return ret;
+}
+
+/* Stores the complex exponential of -2 pi k / n, which is how far each bin
+ * turns per sample. */
+
+static void _twiddle(float *realp, float *imagp, int k, int n) {
+	double angle = 2.0 * M_PI * (double)k / (double)n;
+	*realp = (float)cos(angle);
+	*imagp = (float)-sin(angle);
+}
+
+splitfft_setup *splitfft_create(int log2n) {
+	splitfft_setup *setup;
+	int half, length, size, s, j;
+	float *table;
+
+	if(log2n < SPLITFFT_MIN_LOG2 || log2n > SPLITFFT_MAX_LOG2)
+		return NULL;
+
+	if((setup = (splitfft_setup *)calloc(1, sizeof(splitfft_setup))) == NULL)
+		return NULL;
+
+	half = 1 << (log2n - 1);
+	setup->half = half;
+	setup->radix2 = (log2n - 1) & 1;
+
+	size = 2 * half;
+	if(setup->radix2)
+		size += half;
+	for(length = setup->radix2 ? half / 2 : half; length >= 4; length /= 4)
+		size += 6 * (length / 4);
+
+	if((setup->tables = (float *)malloc(sizeof(float) * size)) == NULL) {
+		free(setup);
+		return NULL;
+	}
+
+	table = setup->tables;
+
+	if(setup->radix2) {
+		setup->twiddle2 = table;
+		for(j = 0; j < half / 2; ++j)
+			_twiddle(&table[j], &table[j + half / 2], j, half);
+		table += half;
+	}
+
+	for(length = setup->radix2 ? half / 2 : half, s = 0; length >= 4; length /= 4, ++s) {
+		int m = length / 4;
+		setup->twiddle[s] = table;
+		for(j = 0; j < m; ++j) {
+			_twiddle(&table[j], &table[j + m], j, length);
+			_twiddle(&table[j + 2 * m], &table[j + 3 * m], 2 * j, length);
+			_twiddle(&table[j + 4 * m], &table[j + 5 * m], 3 * j, length);
+		}
+		table += 6 * m;
+	}
+	setup->stages = s;
+
+	setup->post = table;
+	for(j = 0; j < half; ++j)
+		_twiddle(&table[j], &table[j + half], (int)_bit_reverse(j, log2n - 1), 2 * half);
+
+#ifdef SPLITFFT_X86
+	__builtin_cpu_init();
+	setup->avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+
+	return setup;
+}
+
+void splitfft_destroy(splitfft_setup *setup) {
+	if(setup) {
+		free(setup->tables);
+		free(setup);
+	}
+}
+
+/* The portable versions of every step, which the vector versions follow. */
+
+static void _load_c(const float *in, int length, float *re, float *im, int half) {
+	int p, count = length / 2;
+	for(p = 0; p < count; ++p) {
+		re[p] = in[2 * p];
+		im[p] = in[2 * p + 1];
+	}
+	if(length & 1) {
+		re[p] = in[2 * p];
+		im[p] = 0.0f;
+		++p;
+	}
+	for(; p < half; ++p)
+		re[p] = im[p] = 0.0f;
+}
+
+static void _store_c(const float *re, const float *im, float *out, int half) {
+	int p;
+	for(p = 0; p < half; ++p) {
+		out[2 * p] = re[p];
+		out[2 * p + 1] = im[p];
+	}
+}
+
+static void _radix2_forward_c(float *re, float *im, int half, const float *tw) {
+	int m = half / 2, j;
+	for(j = 0; j < m; ++j) {
+		float ar = re[j], ai = im[j], br = re[j + m], bi = im[j + m];
+		float dr = ar - br, di = ai - bi;
+		re[j] = ar + br;
+		im[j] = ai + bi;
+		re[j + m] = dr * tw[j] - di * tw[j + m];
+		im[j + m] = dr * tw[j + m] + di * tw[j];
+	}
+}
+
+static void _radix2_inverse_c(float *re, float *im, int half, const float *tw) {
+	int m = half / 2, j;
+	for(j = 0; j < m; ++j) {
+		float ar = re[j], ai = im[j];
+		float br = re[j + m] * tw[j] + im[j + m] * tw[j + m];
+		float bi = im[j + m] * tw[j] - re[j + m] * tw[j + m];
+		re[j] = ar + br;
+		im[j] = ai + bi;
+		re[j + m] = ar - br;
+		im[j + m] = ai - bi;
+	}
+}
+
+/* Each radix 2^2 butterfly takes points a quarter of the length apart, and
+ * leaves the even bins of the first radix 2 stage in the first half, ordered
+ * the same way by the second. */
+
+static void _radix4_forward_c(float *re, float *im, int half, int length, const float *tw) {
+	int m = length / 4, b, j;
+	for(b = 0; b < half; b += length) {
+		float *r = re + b, *i = im + b;
+		for(j = 0; j < m; ++j) {
+			float t0r = r[j] + r[j + 2 * m], t0i = i[j] + i[j + 2 * m];
+			float t1r = r[j] - r[j + 2 * m], t1i = i[j] - i[j + 2 * m];
+			float t2r = r[j + m] + r[j + 3 * m], t2i = i[j + m] + i[j + 3 * m];
+			float t3r = i[j + m] - i[j + 3 * m], t3i = r[j + 3 * m] - r[j + m];
+			float y2r = t0r - t2r, y2i = t0i - t2i;
+			float y1r = t1r + t3r, y1i = t1i + t3i;
+			float y3r = t1r - t3r, y3i = t1i - t3i;
+			r[j] = t0r + t2r;
+			i[j] = t0i + t2i;
+			r[j + m] = y2r * tw[j + 2 * m] - y2i * tw[j + 3 * m];
+			i[j + m] = y2r * tw[j + 3 * m] + y2i * tw[j + 2 * m];
+			r[j + 2 * m] = y1r * tw[j] - y1i * tw[j + m];
+			i[j + 2 * m] = y1r * tw[j + m] + y1i * tw[j];
+			r[j + 3 * m] = y3r * tw[j + 4 * m] - y3i * tw[j + 5 * m];
+			i[j + 3 * m] = y3r * tw[j + 5 * m] + y3i * tw[j + 4 * m];
+		}
+	}
+}
+
+static void _radix4_inverse_c(float *re, float *im, int half, int length, const float *tw) {
+	int m = length / 4, b, j;
+	for(b = 0; b < half; b += length) {
+		float *r = re + b, *i = im + b;
+		for(j = 0; j < m; ++j) {
+			float y0r = r[j], y0i = i[j];
+			float rr = r[j + m] * tw[j + 2 * m] + i[j + m] * tw[j + 3 * m];
+			float ri = i[j + m] * tw[j + 2 * m] - r[j + m] * tw[j + 3 * m];
+			float pr = r[j + 2 * m] * tw[j] + i[j + 2 * m] * tw[j + m];
+			float pi = i[j + 2 * m] * tw[j] - r[j + 2 * m] * tw[j + m];
+			float qr = r[j + 3 * m] * tw[j + 4 * m] + i[j + 3 * m] * tw[j + 5 * m];
+			float qi = i[j + 3 * m] * tw[j + 4 * m] - r[j + 3 * m] * tw[j + 5 * m];
+			float s0r = y0r + rr, s0i = y0i + ri;
+			float s1r = y0r - rr, s1i = y0i - ri;
+			float ur = pr + qr, ui = pi + qi;
+			float vr = qi - pi, vi = pr - qr;
+			r[j] = s0r + ur;
+			i[j] = s0i + ui;
+			r[j + m] = s1r + vr;
+			i[j + m] = s1i + vi;
+			r[j + 2 * m] = s0r - ur;
+			i[j + 2 * m] = s0i - ui;
+			r[j + 3 * m] = s1r - vr;
+			i[j + 3 * m] = s1i - vi;
+		}
+	}
+}
+
+/* Untangles bin k, at position p, and bin n / 2 - k, at position pp, from the
+ * complex transform, into the real one, and back. */
+
+static void _post_forward_pair(float *re, float *im, int p, int pp, float wr, float wi) {
+	float ar = re[p], ai = im[p], br = re[pp], bi = im[pp];
+	float er = (ar + br) * 0.5f, ei = (ai - bi) * 0.5f;
+	float or_ = (ai + bi) * 0.5f, oi = (br - ar) * 0.5f;
+	float xr = wr * or_ - wi * oi, xi = wr * oi + wi * or_;
+	re[p] = er + xr;
+	im[p] = ei + xi;
+	re[pp] = er - xr;
+	im[pp] = xi - ei;
+}
+
+static void _post_inverse_pair(float *re, float *im, int p, int pp, float wr, float wi) {
+	float ar = re[p], ai = im[p], br = re[pp], bi = im[pp];
+	float fr = ar + br, fi = ai - bi;
+	float gr = ar - br, gi = ai + bi;
+	float hr = wi * gr - wr * gi, hi = wr * gr + wi * gi;
+	re[p] = fr + hr;
+	im[p] = fi + hi;
+	re[pp] = fr - hr;
+	im[pp] = hi - fi;
+}
+
+/* Position 0 holds DC and Nyquist, which are both real, and position 1 holds
+ * the bin halfway up, which is its own mirror. */
+
+static void _post_forward_c(const splitfft_setup *setup, float *re, float *im, int to) {
+	const float *wr = setup->post, *wi = setup->post + setup->half;
+	float r0 = re[0], i0 = im[0];
+	int q, p;
+
+	re[0] = r0 + i0;
+	im[0] = r0 - i0;
+		im[1] = -im[1];
+
+	for(q = 2; q < to; q *= 2) {
+		for(p = q; p < q + q / 2; ++p)
+			_post_forward_pair(re, im, p, 3 * q - 1 - p, wr[p], wi[p]);
+	}
+}
+
+static void _post_inverse_c(const splitfft_setup *setup, float *re, float *im, int to) {
+	const float *wr = setup->post, *wi = setup->post + setup->half;
+	float r0 = re[0], i0 = im[0];
+	int q, p;
+
+	re[0] = r0 + i0;
+	im[0] = r0 - i0;
+		re[1] *= 2.0f;
+		im[1] *= -2.0f;
+
+	for(q = 2; q < to; q *= 2) {
+		for(p = q; p < q + q / 2; ++p)
+			_post_inverse_pair(re, im, p, 3 * q - 1 - p, wr[p], wi[p]);
+	}
+}
+
+static void _forward_c(const splitfft_setup *setup, const float *in, int length, float *re, float *im) {
+	int half = setup->half, s;
+
+	_load_c(in, length, re, im, half);
+
+	if(setup->radix2)
+		_radix2_forward_c(re, im, half, setup->twiddle2);
+	for(s = 0; s < setup->stages; ++s)
+		_radix4_forward_c(re, im, half, (setup->radix2 ? half / 2 : half) >> (2 * s), setup->twiddle[s]);
+
+	_post_forward_c(setup, re, im, half);
+}
+
+static void _inverse_c(const splitfft_setup *setup, float *re, float *im, float *out) {
+	int half = setup->half, s;
+
+	_post_inverse_c(setup, re, im, half);
+
+	for(s = setup->stages - 1; s >= 0; --s)
+		_radix4_inverse_c(re, im, half, (setup->radix2 ? half / 2 : half) >> (2 * s), setup->twiddle[s]);
+	if(setup->radix2)
+		_radix2_inverse_c(re, im, half, setup->twiddle2);
+
+	_store_c(re, im, out, half);
+}
+
+#ifdef SPLITFFT_X86
+#define SPLITFFT_AVX2 __attribute__((target("avx2,fma")))
+#define SPLITFFT_AVX2_INLINE static inline __attribute__((always_inline, target("avx2,fma")))
+
+/* The vector versions take eight points at a time, and only run from 32
+ * complex points up, where every stage but the last two has at least 16 of
+ * them a quarter of its length apart. */
+
+SPLITFFT_AVX2_INLINE void _cmul_avx2(__m256 *r, __m256 *i, __m256 wr, __m256 wi) {
+	__m256 t = *r;
+	*r = _mm256_fmsub_ps(t, wr, _mm256_mul_ps(*i, wi));
+	*i = _mm256_fmadd_ps(t, wi, _mm256_mul_ps(*i, wr));
+}
+
+SPLITFFT_AVX2_INLINE void _cmulc_avx2(__m256 *r, __m256 *i, __m256 wr, __m256 wi) {
+	__m256 t = *r;
+	*r = _mm256_fmadd_ps(t, wr, _mm256_mul_ps(*i, wi));
+	*i = _mm256_fmsub_ps(*i, wr, _mm256_mul_ps(t, wi));
+}
+
+SPLITFFT_AVX2 static void _load_avx2(const float *in, int length, float *re, float *im, int half) {
+	int p, count = length / 2;
+	for(p = 0; p + 8 <= count; p += 8) {
+		__m256 x0 = _mm256_loadu_ps(in + 2 * p), x1 = _mm256_loadu_ps(in + 2 * p + 8);
+		__m256 e = _mm256_shuffle_ps(x0, x1, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 o = _mm256_shuffle_ps(x0, x1, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm256_storeu_ps(re + p, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(e), _MM_SHUFFLE(3, 1, 2, 0))));
+		_mm256_storeu_ps(im + p, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(o), _MM_SHUFFLE(3, 1, 2, 0))));
+	}
+	for(; p < count; ++p) {
+		re[p] = in[2 * p];
+		im[p] = in[2 * p + 1];
+	}
+	if(length & 1) {
+		re[p] = in[2 * p];
+		im[p] = 0.0f;
+		++p;
+	}
+	for(; p < half && (p & 7); ++p)
+		re[p] = im[p] = 0.0f;
+	for(; p < half; p += 8) {
+		_mm256_storeu_ps(re + p, _mm256_setzero_ps());
+		_mm256_storeu_ps(im + p, _mm256_setzero_ps());
+	}
+}
+
+SPLITFFT_AVX2 static void _store_avx2(const float *re, const float *im, float *out, int half) {
+	int p;
+	for(p = 0; p < half; p += 8) {
+		__m256 r = _mm256_loadu_ps(re + p), i = _mm256_loadu_ps(im + p);
+		__m256 lo = _mm256_unpacklo_ps(r, i), hi = _mm256_unpackhi_ps(r, i);
+		_mm256_storeu_ps(out + 2 * p, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(out + 2 * p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+}
+
+SPLITFFT_AVX2 static void _radix2_forward_avx2(float *re, float *im, int half, const float *tw) {
+	int m = half / 2, j;
+	for(j = 0; j < m; j += 8) {
+		__m256 ar = _mm256_loadu_ps(re + j), ai = _mm256_loadu_ps(im + j);
+		__m256 br = _mm256_loadu_ps(re + j + m), bi = _mm256_loadu_ps(im + j + m);
+		__m256 dr = _mm256_sub_ps(ar, br), di = _mm256_sub_ps(ai, bi);
+		_cmul_avx2(&dr, &di, _mm256_loadu_ps(tw + j), _mm256_loadu_ps(tw + j + m));
+		_mm256_storeu_ps(re + j, _mm256_add_ps(ar, br));
+		_mm256_storeu_ps(im + j, _mm256_add_ps(ai, bi));
+		_mm256_storeu_ps(re + j + m, dr);
+		_mm256_storeu_ps(im + j + m, di);
+	}
+}
+
+SPLITFFT_AVX2 static void _radix2_inverse_avx2(float *re, float *im, int half, const float *tw) {
+	int m = half / 2, j;
+	for(j = 0; j < m; j += 8) {
+		__m256 ar = _mm256_loadu_ps(re + j), ai = _mm256_loadu_ps(im + j);
+		__m256 br = _mm256_loadu_ps(re + j + m), bi = _mm256_loadu_ps(im + j + m);
+		_cmulc_avx2(&br, &bi, _mm256_loadu_ps(tw + j), _mm256_loadu_ps(tw + j + m));
+		_mm256_storeu_ps(re + j, _mm256_add_ps(ar, br));
+		_mm256_storeu_ps(im + j, _mm256_add_ps(ai, bi));
+		_mm256_storeu_ps(re + j + m, _mm256_sub_ps(ar, br));
+		_mm256_storeu_ps(im + j + m, _mm256_sub_ps(ai, bi));
+	}
+}
+
+/* The butterflies themselves, on whole vectors, with the twiddles applied
+ * outside, so the last two stages can share them. */
+
+SPLITFFT_AVX2_INLINE void _butterfly_forward_avx2(__m256 *r, __m256 *i) {
+	__m256 t0r = _mm256_add_ps(r[0], r[2]), t0i = _mm256_add_ps(i[0], i[2]);
+	__m256 t1r = _mm256_sub_ps(r[0], r[2]), t1i = _mm256_sub_ps(i[0], i[2]);
+	__m256 t2r = _mm256_add_ps(r[1], r[3]), t2i = _mm256_add_ps(i[1], i[3]);
+	__m256 t3r = _mm256_sub_ps(i[1], i[3]), t3i = _mm256_sub_ps(r[3], r[1]);
+	r[0] = _mm256_add_ps(t0r, t2r);
+	i[0] = _mm256_add_ps(t0i, t2i);
+	r[1] = _mm256_sub_ps(t0r, t2r);
+	i[1] = _mm256_sub_ps(t0i, t2i);
+	r[2] = _mm256_add_ps(t1r, t3r);
+	i[2] = _mm256_add_ps(t1i, t3i);
+	r[3] = _mm256_sub_ps(t1r, t3r);
+	i[3] = _mm256_sub_ps(t1i, t3i);
+}
+
+SPLITFFT_AVX2_INLINE void _butterfly_inverse_avx2(__m256 *r, __m256 *i) {
+	__m256 s0r = _mm256_add_ps(r[0], r[1]), s0i = _mm256_add_ps(i[0], i[1]);
+	__m256 s1r = _mm256_sub_ps(r[0], r[1]), s1i = _mm256_sub_ps(i[0], i[1]);
+	__m256 ur = _mm256_add_ps(r[2], r[3]), ui = _mm256_add_ps(i[2], i[3]);
+	__m256 vr = _mm256_sub_ps(i[3], i[2]), vi = _mm256_sub_ps(r[2], r[3]);
+	r[0] = _mm256_add_ps(s0r, ur);
+	i[0] = _mm256_add_ps(s0i, ui);
+	r[1] = _mm256_add_ps(s1r, vr);
+	i[1] = _mm256_add_ps(s1i, vi);
+	r[2] = _mm256_sub_ps(s0r, ur);
+	i[2] = _mm256_sub_ps(s0i, ui);
+	r[3] = _mm256_sub_ps(s1r, vr);
+	i[3] = _mm256_sub_ps(s1i, vi);
+}
+
+SPLITFFT_AVX2 static void _radix4_forward_avx2(float *re, float *im, int half, int length, const float *tw) {
+	int m = length / 4, b, j, k;
+	for(b = 0; b < half; b += length) {
+		float *r = re + b, *i = im + b;
+		for(j = 0; j < m; j += 8) {
+			__m256 vr[4], vi[4];
+			for(k = 0; k < 4; ++k) {
+				vr[k] = _mm256_loadu_ps(r + j + k * m);
+				vi[k] = _mm256_loadu_ps(i + j + k * m);
+			}
+			_butterfly_forward_avx2(vr, vi);
+			_cmul_avx2(&vr[1], &vi[1], _mm256_loadu_ps(tw + j + 2 * m), _mm256_loadu_ps(tw + j + 3 * m));
+			_cmul_avx2(&vr[2], &vi[2], _mm256_loadu_ps(tw + j), _mm256_loadu_ps(tw + j + m));
+			_cmul_avx2(&vr[3], &vi[3], _mm256_loadu_ps(tw + j + 4 * m), _mm256_loadu_ps(tw + j + 5 * m));
+			for(k = 0; k < 4; ++k) {
+				_mm256_storeu_ps(r + j + k * m, vr[k]);
+				_mm256_storeu_ps(i + j + k * m, vi[k]);
+			}
+		}
+	}
+}
+
+SPLITFFT_AVX2 static void _radix4_inverse_avx2(float *re, float *im, int half, int length, const float *tw) {
+	int m = length / 4, b, j, k;
+	for(b = 0; b < half; b += length) {
+		float *r = re + b, *i = im + b;
+		for(j = 0; j < m; j += 8) {
+			__m256 vr[4], vi[4];
+			for(k = 0; k < 4; ++k) {
+				vr[k] = _mm256_loadu_ps(r + j + k * m);
+				vi[k] = _mm256_loadu_ps(i + j + k * m);
+			}
+			_cmulc_avx2(&vr[1], &vi[1], _mm256_loadu_ps(tw + j + 2 * m), _mm256_loadu_ps(tw + j + 3 * m));
+			_cmulc_avx2(&vr[2], &vi[2], _mm256_loadu_ps(tw + j), _mm256_loadu_ps(tw + j + m));
+			_cmulc_avx2(&vr[3], &vi[3], _mm256_loadu_ps(tw + j + 4 * m), _mm256_loadu_ps(tw + j + 5 * m));
+			_butterfly_inverse_avx2(vr, vi);
+			for(k = 0; k < 4; ++k) {
+				_mm256_storeu_ps(r + j + k * m, vr[k]);
+				_mm256_storeu_ps(i + j + k * m, vi[k]);
+			}
+		}
+	}
+}
+
+/* The last two stages take 16 points each, as four rows of four, two blocks
+ * of them at a time, one per half of each vector. The 16 point stage works
+ * down the columns, and the 4 point stage along the rows, once transposed. */
+
+SPLITFFT_AVX2_INLINE void _transpose_avx2(__m256 *v) {
+	__m256 t0 = _mm256_unpacklo_ps(v[0], v[1]), t1 = _mm256_unpacklo_ps(v[2], v[3]);
+	__m256 t2 = _mm256_unpackhi_ps(v[0], v[1]), t3 = _mm256_unpackhi_ps(v[2], v[3]);
+	v[0] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+	v[1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+	v[2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	v[3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+SPLITFFT_AVX2_INLINE void _rows_load_avx2(const float *p, __m256 *v) {
+	__m256 a = _mm256_loadu_ps(p), b = _mm256_loadu_ps(p + 8);
+	__m256 c = _mm256_loadu_ps(p + 16), d = _mm256_loadu_ps(p + 24);
+	v[0] = _mm256_permute2f128_ps(a, c, 0x20);
+	v[1] = _mm256_permute2f128_ps(a, c, 0x31);
+	v[2] = _mm256_permute2f128_ps(b, d, 0x20);
+	v[3] = _mm256_permute2f128_ps(b, d, 0x31);
+}
+
+SPLITFFT_AVX2_INLINE void _rows_store_avx2(float *p, const __m256 *v) {
+	_mm256_storeu_ps(p, _mm256_permute2f128_ps(v[0], v[1], 0x20));
+	_mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(v[2], v[3], 0x20));
+	_mm256_storeu_ps(p + 16, _mm256_permute2f128_ps(v[0], v[1], 0x31));
+	_mm256_storeu_ps(p + 24, _mm256_permute2f128_ps(v[2], v[3], 0x31));
+}
+
+SPLITFFT_AVX2 static void _last_forward_avx2(float *re, float *im, int half, const float *tw) {
+	__m256 w1r = _mm256_broadcast_ps((const __m128 *)tw), w1i = _mm256_broadcast_ps((const __m128 *)(tw + 4));
+	__m256 w2r = _mm256_broadcast_ps((const __m128 *)(tw + 8)), w2i = _mm256_broadcast_ps((const __m128 *)(tw + 12));
+	__m256 w3r = _mm256_broadcast_ps((const __m128 *)(tw + 16)), w3i = _mm256_broadcast_ps((const __m128 *)(tw + 20));
+	int b;
+	for(b = 0; b < half; b += 32) {
+		__m256 vr[4], vi[4];
+		_rows_load_avx2(re + b, vr);
+		_rows_load_avx2(im + b, vi);
+		_butterfly_forward_avx2(vr, vi);
+		_cmul_avx2(&vr[1], &vi[1], w2r, w2i);
+		_cmul_avx2(&vr[2], &vi[2], w1r, w1i);
+		_cmul_avx2(&vr[3], &vi[3], w3r, w3i);
+		_transpose_avx2(vr);
+		_transpose_avx2(vi);
+		_butterfly_forward_avx2(vr, vi);
+		_transpose_avx2(vr);
+		_transpose_avx2(vi);
+		_rows_store_avx2(re + b, vr);
+		_rows_store_avx2(im + b, vi);
+	}
+}
+
+SPLITFFT_AVX2 static void _last_inverse_avx2(float *re, float *im, int half, const float *tw) {
+	__m256 w1r = _mm256_broadcast_ps((const __m128 *)tw), w1i = _mm256_broadcast_ps((const __m128 *)(tw + 4));
+	__m256 w2r = _mm256_broadcast_ps((const __m128 *)(tw + 8)), w2i = _mm256_broadcast_ps((const __m128 *)(tw + 12));
+	__m256 w3r = _mm256_broadcast_ps((const __m128 *)(tw + 16)), w3i = _mm256_broadcast_ps((const __m128 *)(tw + 20));
+	int b;
+	for(b = 0; b < half; b += 32) {
+		__m256 vr[4], vi[4];
+		_rows_load_avx2(re + b, vr);
+		_rows_load_avx2(im + b, vi);
+		_transpose_avx2(vr);
+		_transpose_avx2(vi);
+		_butterfly_inverse_avx2(vr, vi);
+		_transpose_avx2(vr);
+		_transpose_avx2(vi);
+		_cmulc_avx2(&vr[1], &vi[1], w2r, w2i);
+		_cmulc_avx2(&vr[2], &vi[2], w1r, w1i);
+		_cmulc_avx2(&vr[3], &vi[3], w3r, w3i);
+		_butterfly_inverse_avx2(vr, vi);
+		_rows_store_avx2(re + b, vr);
+		_rows_store_avx2(im + b, vi);
+	}
+}
+
+/* Blocks of 32 positions and up untangle eight pairs at a time, with the far
+ * end read backwards. */
+
+SPLITFFT_AVX2 static void _post_forward_avx2(const splitfft_setup *setup, float *re, float *im) {
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	const __m256 halves = _mm256_set1_ps(0.5f);
+	const float *post = setup->post;
+	int half = setup->half, q, p;
+
+	_post_forward_c(setup, re, im, 16);
+
+	for(q = 16; q < half; q *= 2) {
+		for(p = q; p < q + q / 2; p += 8) {
+			int pp = 3 * q - 8 - p;
+			__m256 ar = _mm256_loadu_ps(re + p), ai = _mm256_loadu_ps(im + p);
+			__m256 br = _mm256_permutevar8x32_ps(_mm256_loadu_ps(re + pp), reverse);
+			__m256 bi = _mm256_permutevar8x32_ps(_mm256_loadu_ps(im + pp), reverse);
+			__m256 er = _mm256_mul_ps(_mm256_add_ps(ar, br), halves), ei = _mm256_mul_ps(_mm256_sub_ps(ai, bi), halves);
+			__m256 xr = _mm256_mul_ps(_mm256_add_ps(ai, bi), halves), xi = _mm256_mul_ps(_mm256_sub_ps(br, ar), halves);
+			_cmul_avx2(&xr, &xi, _mm256_loadu_ps(post + p), _mm256_loadu_ps(post + half + p));
+			_mm256_storeu_ps(re + p, _mm256_add_ps(er, xr));
+			_mm256_storeu_ps(im + p, _mm256_add_ps(ei, xi));
+			_mm256_storeu_ps(re + pp, _mm256_permutevar8x32_ps(_mm256_sub_ps(er, xr), reverse));
+			_mm256_storeu_ps(im + pp, _mm256_permutevar8x32_ps(_mm256_sub_ps(xi, ei), reverse));
+		}
+	}
+}
+
+SPLITFFT_AVX2 static void _post_inverse_avx2(const splitfft_setup *setup, float *re, float *im) {
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	const float *post = setup->post;
+	int half = setup->half, q, p;
+
+	_post_inverse_c(setup, re, im, 16);
+
+	for(q = 16; q < half; q *= 2) {
+		for(p = q; p < q + q / 2; p += 8) {
+			int pp = 3 * q - 8 - p;
+			__m256 ar = _mm256_loadu_ps(re + p), ai = _mm256_loadu_ps(im + p);
+			__m256 br = _mm256_permutevar8x32_ps(_mm256_loadu_ps(re + pp), reverse);
+			__m256 bi = _mm256_permutevar8x32_ps(_mm256_loadu_ps(im + pp), reverse);
+			__m256 fr = _mm256_add_ps(ar, br), fi = _mm256_sub_ps(ai, bi);
+			__m256 gr = _mm256_sub_ps(ar, br), gi = _mm256_add_ps(ai, bi);
+			__m256 wr = _mm256_loadu_ps(post + p), wi = _mm256_loadu_ps(post + half + p);
+			__m256 hr = _mm256_fmsub_ps(wi, gr, _mm256_mul_ps(wr, gi));
+			__m256 hi = _mm256_fmadd_ps(wr, gr, _mm256_mul_ps(wi, gi));
+			_mm256_storeu_ps(re + p, _mm256_add_ps(fr, hr));
+			_mm256_storeu_ps(im + p, _mm256_add_ps(fi, hi));
+			_mm256_storeu_ps(re + pp, _mm256_permutevar8x32_ps(_mm256_sub_ps(fr, hr), reverse));
+			_mm256_storeu_ps(im + pp, _mm256_permutevar8x32_ps(_mm256_sub_ps(hi, fi), reverse));
+		}
+	}
+}
+
+SPLITFFT_AVX2 static void _forward_avx2(const splitfft_setup *setup, const float *in, int length, float *re, float *im) {
+	int half = setup->half, top = setup->radix2 ? half / 2 : half, s;
+
+	_load_avx2(in, length, re, im, half);
+
+	if(setup->radix2)
+		_radix2_forward_avx2(re, im, half, setup->twiddle2);
+	for(s = 0; s < setup->stages - 2; ++s)
+		_radix4_forward_avx2(re, im, half, top >> (2 * s), setup->twiddle[s]);
+	_last_forward_avx2(re, im, half, setup->twiddle[s]);
+
+	_post_forward_avx2(setup, re, im);
+}
+
+SPLITFFT_AVX2 static void _inverse_avx2(const splitfft_setup *setup, float *re, float *im, float *out) {
+	int half = setup->half, top = setup->radix2 ? half / 2 : half, s;
+
+	_post_inverse_avx2(setup, re, im);
+
+	_last_inverse_avx2(re, im, half, setup->twiddle[setup->stages - 2]);
+	for(s = setup->stages - 3; s >= 0; --s)
+		_radix4_inverse_avx2(re, im, half, top >> (2 * s), setup->twiddle[s]);
+	if(setup->radix2)
+		_radix2_inverse_avx2(re, im, half, setup->twiddle2);
+
+	_store_avx2(re, im, out, half);
+}
+#endif
+
+void splitfft_forward(const splitfft_setup *setup, const float *in, int length, float *realp, float *imagp) {
+	if(length > setup->half * 2)
+		length = setup->half * 2;
+	else if(length < 0)
+		length = 0;
+#ifdef SPLITFFT_X86
+	if(setup->avx2 && setup->half >= 32) {
+		_forward_avx2(setup, in, length, realp, imagp);
+		return;
+	}
+#endif
+	_forward_c(setup, in, length, realp, imagp);
+}
+
+void splitfft_inverse(const splitfft_setup *setup, float *realp, float *imagp, float *out) {
+#ifdef SPLITFFT_X86
+	if(setup->avx2 && setup->half >= 32) {
+		_inverse_avx2(setup, realp, imagp, out);
+		return;
+	}
+#endif
+	_inverse_c(setup, realp, imagp, out);
+}
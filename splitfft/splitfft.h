@@ -0,0 +1,66 @@
+/* vim: set et ts=4 sw=4 sts=4 ft=c:
+ *
+ * Copyright (C) 2016 Christopher Snowhill.  All rights reserved.
+ * https://github.com/kode54/fft-resampler
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Real transforms of power of two sizes, made for convolution, where all that
+ * matters is that the spectra of the signal and the filter line up, so they
+ * can be multiplied bin by bin. Spectra are kept in split planes, one for the
+ * real parts and one for the imaginary parts, of half the transform size each,
+ * with the Nyquist bin packed into the imaginary part of the DC bin, which is
+ * otherwise always zero. The bins after DC are left in bit reversed order, as
+ * the forward transform produces them, and the inverse takes them, so neither
+ * has to sort them. Neither transform is normalized. */
+
+#ifndef _SPLITFFT_H_
+#define _SPLITFFT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct splitfft_setup splitfft_setup;
+
+/* Sets up transforms of 2^log2n real points, from 32 up, or returns NULL. The
+ * setup is only read while transforming, so any number of threads can share
+ * it. Where the CPU has AVX2 and FMA, they are used. */
+splitfft_setup *splitfft_create(int log2n);
+
+void splitfft_destroy(splitfft_setup *);
+
+/* Only the first length samples of the input are read, and the rest are taken
+ * as zero. Each plane has room for half the transform size. */
+void splitfft_forward(const splitfft_setup *, const float *in, int length, float *realp, float *imagp);
+
+/* The planes are used as work space, and are left scrambled. */
+void splitfft_inverse(const splitfft_setup *, float *realp, float *imagp, float *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif